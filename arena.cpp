@@ -0,0 +1,146 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <iterator>
+
+Arena::Slab::Slab(void* owner, uint32_t size)
+    : owner(owner),
+      cell_size(size), reciprocal(static_cast<uint32_t>(((uint64_t{1} << 32) + size - 1) / size)) {
+    size_t header = (sizeof(Slab) + kGranule - 1) / kGranule * kGranule;
+    cells = reinterpret_cast<char*>(this) + header;
+    capacity = static_cast<uint32_t>((kSlabSize - header) / size);
+}
+
+namespace {
+
+void FreeSlabMemory(void* memory) {
+    ::operator delete(memory, std::align_val_t{Arena::kSlabSize});
+}
+
+}  // namespace
+
+Arena::~Arena() {
+    for (SizeClass& cls : classes_) {
+        for (Slab* slab : cls.slabs) {
+            slab->~Slab();
+            FreeSlabMemory(slab);
+        }
+    }
+}
+
+void* Arena::AllocateSlow(SizeClass& cls, size_t size) {
+    for (; cls.cursor < cls.slabs.size(); ++cls.cursor) {
+        Slab* slab = cls.slabs[cls.cursor];
+        if (!slab->unswept && slab->HasRoom()) {
+            slab->has_fresh = true;
+            cls.current = slab;
+            return slab->Take();
+        }
+    }
+    void* memory = ::operator new(kSlabSize, std::align_val_t{kSlabSize});
+    uint32_t cell_size = static_cast<uint32_t>((size + kGranule - 1) / kGranule * kGranule);
+    Slab* slab = new (memory) Slab(owner_, cell_size);
+    slab->has_fresh = true;
+    cls.slabs.push_back(slab);
+    cls.cursor = cls.slabs.size() - 1;
+    cls.current = slab;
+    return slab->Take();
+}
+
+void Arena::ReleaseEmpty(SizeClass& cls, size_t in_use) {
+    // in_use slabs held objects before this sweep. Empty slabs are kept up to the smaller of that
+    // and the same count at the previous sweep, so a steady allocation rate reuses them instead
+    // of going back to the system every cycle, while memory taken for a spike, or no longer
+    // needed once allocation stops, is returned a sweep later.
+    size_t budget = std::min(in_use, cls.previous_in_use);
+    cls.previous_in_use = in_use;
+    size_t occupied = 0;
+    for (Slab* slab : cls.slabs) {
+        occupied += slab->live > 0;
+    }
+    size_t reserve = budget > occupied ? budget - occupied : 0;
+    size_t releasable = release_limit_;
+
+    size_t j = 0;
+    for (Slab* slab : cls.slabs) {
+        if (slab->live > 0) {
+            cls.slabs[j++] = slab;
+        } else if (reserve > 0 || releasable == 0) {
+            // Start the slab over, so that it is filled by bumping again.
+            uint32_t cell_size = slab->cell_size;
+            slab->~Slab();
+            cls.slabs[j++] = new (slab) Slab(owner_, cell_size);
+            reserve -= reserve > 0;
+        } else {
+            slab->~Slab();
+            FreeSlabMemory(slab);
+            --releasable;
+        }
+    }
+    cls.slabs.resize(j);
+    cls.current = nullptr;
+    cls.cursor = 0;
+}
+
+void Arena::BeginSweep() {
+    for (SizeClass& cls : classes_) {
+        cls.sweep_in_use = 0;
+        for (Slab* slab : cls.slabs) {
+            cls.sweep_in_use += slab->live > 0;
+            slab->unswept = true;
+            unswept_.push_back(slab);
+        }
+        cls.current = nullptr;
+        cls.cursor = 0;
+    }
+}
+
+void Arena::Trim() {
+    for (SizeClass& cls : classes_) {
+        size_t j = 0;
+        for (Slab* slab : cls.slabs) {
+            if (slab->live > 0) {
+                cls.slabs[j++] = slab;
+            } else {
+                slab->~Slab();
+                FreeSlabMemory(slab);
+            }
+        }
+        cls.slabs.resize(j);
+        cls.current = nullptr;
+        cls.cursor = 0;
+    }
+}
+
+void Arena::Splice(Arena& other) {
+    for (size_t i = 0; i < std::size(classes_); ++i) {
+        SizeClass& from = other.classes_[i];
+        for (Slab* slab : from.slabs) {
+            slab->owner = owner_;
+        }
+        classes_[i].slabs.insert(classes_[i].slabs.end(), from.slabs.begin(), from.slabs.end());
+        from.slabs.clear();
+        from.current = nullptr;
+        from.cursor = 0;
+    }
+}
+
+void Arena::Swap(Arena& other) {
+    std::swap(classes_, other.classes_);
+    std::swap(unswept_, other.unswept_);
+    for (Arena* arena : {this, &other}) {
+        for (SizeClass& cls : arena->classes_) {
+            for (Slab* slab : cls.slabs) {
+                slab->owner = arena->owner_;
+            }
+        }
+    }
+}
+
+size_t Arena::SlabCount() const {
+    size_t count = 0;
+    for (const SizeClass& cls : classes_) {
+        count += cls.slabs.size();
+    }
+    return count;
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Backing memory for heap objects. Sizes are rounded up to a size class (a multiple of 16 bytes),
+// and every class carves its cells out of its own 64 KiB slabs: allocating pops the free list of
+// the current slab or bumps a pointer through it, without a call into malloc. Sweep() returns dead
+// cells to their slab and releases slabs that no longer hold anything.
+//
+// The arena also remembers which cells were allocated since the last sweep ("fresh" cells), so a
+// collector can sweep just those, and which slabs had a cell written to (see MarkDirty).
+class Arena {
+public:
+    static constexpr size_t kGranule = 16;
+    static constexpr size_t kMaxSize = 1024;
+    static constexpr size_t kSlabSize = size_t{1} << 16;
+
+    // Owner is whatever the cells belong to, as returned by OwnerOf.
+    explicit Arena(void* owner = nullptr) : owner_(owner) {
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    // size must be at most kMaxSize. The cell is aligned to kGranule.
+    void* Allocate(size_t size) {
+        SizeClass& cls = classes_[(size - 1) / kGranule];
+        if (cls.current) {
+            if (void* cell = cls.current->Take()) {
+                return cell;
+            }
+        }
+        return AllocateSlow(cls, size);
+    }
+
+    // Returns a cell that holds no object.
+    void Free(void* cell) {
+        Slab* slab = SlabOf(cell);
+        slab->Release(cell, slab->IndexOf(cell));
+    }
+
+    // Calls dead(cell) for every allocated cell and frees the cells it returns true for; the
+    // callback destroys their objects. Slabs left empty go back to the system unless the recent
+    // allocation volume calls for them. Returns the number of cells still allocated. Afterwards no
+    // cell is fresh and no slab is dirty. Any sweep begun by BeginSweep is over as well.
+    template <class F>
+    size_t Sweep(F&& dead) {
+        return SweepSlabs(dead, false);
+    }
+
+    // Like Sweep, with the slabs divided among threads threads, the calling one included. dead is
+    // called concurrently for cells of different slabs.
+    template <class F>
+    size_t SweepParallel(F&& dead, size_t threads) {
+        unswept_.clear();
+        std::vector<Slab*> slabs;
+        size_t in_use[kMaxSize / kGranule] = {};
+        for (size_t i = 0; i < std::size(classes_); ++i) {
+            for (Slab* slab : classes_[i].slabs) {
+                in_use[i] += slab->live > 0;
+                slabs.push_back(slab);
+            }
+        }
+        std::atomic<size_t> next{0};
+        auto sweep = [&slabs, &next, &dead] {
+            size_t begin;
+            while ((begin = next.fetch_add(kSweepChunk)) < slabs.size()) {
+                size_t end = std::min(begin + kSweepChunk, slabs.size());
+                for (size_t i = begin; i < end; ++i) {
+                    slabs[i]->Sweep(dead, false);
+                }
+            }
+        };
+        std::vector<std::thread> helpers;
+        for (size_t i = 1; i < threads; ++i) {
+            helpers.emplace_back(sweep);
+        }
+        sweep();
+        for (std::thread& helper : helpers) {
+            helper.join();
+        }
+
+        size_t live = 0;
+        for (size_t i = 0; i < std::size(classes_); ++i) {
+            for (Slab* slab : classes_[i].slabs) {
+                live += slab->live;
+            }
+            ReleaseEmpty(classes_[i], in_use[i]);
+        }
+        return live;
+    }
+
+    // Starts a sweep done a few slabs at a time by SweepSome, so that its cost is spread over
+    // the program's allocations. The slabs there are now are set aside until swept; cells are
+    // allocated from the others or from new slabs meanwhile.
+    void BeginSweep();
+
+    bool IsSweeping() const {
+        return !unswept_.empty();
+    }
+
+    // Calls dead(cell) for every allocated cell of up to count slabs set aside by BeginSweep, and
+    // frees the cells it returns true for. Unlike Sweep, it leaves the survivors fresh and the
+    // slabs dirty. Once no slab is left, releases empty slabs as Sweep does and returns true.
+    template <class F>
+    bool SweepSome(F&& dead, size_t count) {
+        for (; count > 0 && !unswept_.empty(); --count) {
+            Slab* slab = unswept_.back();
+            unswept_.pop_back();
+            slab->unswept = false;
+            slab->ForEach([slab, &dead](void* cell, size_t index) {
+                if (dead(cell)) {
+                    slab->Release(cell, index);
+                }
+            });
+        }
+        if (!unswept_.empty()) {
+            return false;
+        }
+        for (SizeClass& cls : classes_) {
+            ReleaseEmpty(cls, cls.sweep_in_use);
+        }
+        return true;
+    }
+
+    // Like Sweep, but only offers the fresh cells to dead. The other cells stay allocated, and
+    // dirty slabs stay dirty.
+    template <class F>
+    size_t SweepFresh(F&& dead) {
+        return SweepSlabs(dead, true);
+    }
+
+    // Calls func(cell) for every allocated cell.
+    template <class F>
+    void ForEach(F&& func) {
+        for (SizeClass& cls : classes_) {
+            for (Slab* slab : cls.slabs) {
+                slab->ForEach([&func](void* cell, size_t) { func(cell); });
+            }
+        }
+    }
+
+    // Calls func(cell) for every fresh cell.
+    template <class F>
+    void ForEachFresh(F&& func) {
+        for (SizeClass& cls : classes_) {
+            for (Slab* slab : cls.slabs) {
+                if (slab->has_fresh) {
+                    slab->ForEachFresh([&func](void* cell, size_t) { func(cell); });
+                }
+            }
+        }
+    }
+
+    // The owner of the arena the cell was allocated from.
+    static void* OwnerOf(void* cell) {
+        return SlabOf(cell)->owner;
+    }
+
+    // Notes that an object was stored into the cell, which must have come from an arena.
+    static void MarkDirty(void* cell) {
+        SlabOf(cell)->dirty = true;
+    }
+
+    // Calls func(cell) for every allocated cell of the dirty slabs and makes them clean.
+    template <class F>
+    void ForEachInDirtySlabs(F&& func) {
+        for (SizeClass& cls : classes_) {
+            for (Slab* slab : cls.slabs) {
+                if (slab->dirty) {
+                    slab->dirty = false;
+                    slab->ForEach([&func](void* cell, size_t) { func(cell); });
+                }
+            }
+        }
+    }
+
+    // Takes over all memory of other, which is left empty. Fresh cells and dirty slabs stay so.
+    // Cells that were allocated from other belong to this arena's owner afterwards.
+    void Splice(Arena& other);
+
+    // Slabs of each size class that one sweep gives back to the system at most. Returning memory
+    // takes a system call per slab, so a sweep after a large collection can spend longer on that
+    // than on the objects; with a limit, the other empty slabs stay reserved until later sweeps.
+    void SetReleaseLimit(size_t slabs) {
+        release_limit_ = slabs;
+    }
+
+    // Gives every empty slab back to the system, whatever the recent allocation volume. Must not be
+    // called while a sweep begun by BeginSweep is unfinished.
+    void Trim();
+
+    // Exchanges all memory with other; each keeps its owner.
+    void Swap(Arena& other);
+
+    size_t SlabCount() const;
+
+private:
+    // Slabs a thread of SweepParallel takes at a time.
+    static constexpr size_t kSweepChunk = 16;
+
+    struct FreeCell {
+        FreeCell* next;
+    };
+
+    // Lives at the start of its kSlabSize-aligned block, so a cell finds it by masking its address.
+    struct Slab {
+        static constexpr size_t kMaxCells = kSlabSize / kGranule;
+
+        void* owner;
+        uint32_t cell_size;
+        // ceil(2^32 / cell_size): offsets within a slab divide exactly by multiplying with it.
+        uint32_t reciprocal;
+        uint32_t capacity;
+        uint32_t bumped = 0;
+        uint32_t live = 0;
+        char* cells;
+        FreeCell* free = nullptr;
+        // Set while the slab is current, so that it holds fresh cells.
+        bool has_fresh = false;
+        bool dirty = false;
+        // Set aside by BeginSweep and not swept yet, so that nothing is allocated from it.
+        bool unswept = false;
+        uint64_t allocated[kMaxCells / 64] = {};
+        uint64_t fresh[kMaxCells / 64] = {};
+
+        Slab(void* owner, uint32_t size);
+
+        bool HasRoom() const {
+            return free || bumped < capacity;
+        }
+
+        size_t IndexOf(void* cell) const {
+            uint64_t offset = static_cast<char*>(cell) - cells;
+            return (offset * reciprocal) >> 32;
+        }
+
+        void* Take() {
+            char* cell;
+            size_t index;
+            if (free) {
+                cell = reinterpret_cast<char*>(free);
+                free = free->next;
+                index = IndexOf(cell);
+            } else if (bumped < capacity) {
+                index = bumped++;
+                cell = cells + index * cell_size;
+            } else {
+                return nullptr;
+            }
+            allocated[index / 64] |= uint64_t{1} << (index % 64);
+            fresh[index / 64] |= uint64_t{1} << (index % 64);
+            ++live;
+            return cell;
+        }
+
+        void Release(void* cell, size_t index) {
+            allocated[index / 64] &= ~(uint64_t{1} << (index % 64));
+            fresh[index / 64] &= ~(uint64_t{1} << (index % 64));
+            --live;
+            free = new (cell) FreeCell{free};
+        }
+
+        template <class F>
+        void ForEach(F&& func) {
+            ForEachIn(allocated, func);
+        }
+
+        template <class F>
+        void ForEachFresh(F&& func) {
+            ForEachIn(fresh, func);
+        }
+
+        template <class F>
+        void ForEachIn(const uint64_t* bitmap, F& func) {
+            for (size_t word = 0; word * 64 < bumped; ++word) {
+                uint64_t bits = bitmap[word];
+                while (bits) {
+                    size_t index = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    func(cells + index * cell_size, index);
+                }
+            }
+        }
+
+        template <class F>
+        void Sweep(F& dead, bool fresh_only) {
+            auto visit = [this, &dead](void* cell, size_t index) {
+                if (dead(cell)) {
+                    Release(cell, index);
+                }
+            };
+            if (fresh_only) {
+                ForEachIn(fresh, visit);
+            } else {
+                ForEachIn(allocated, visit);
+                dirty = false;
+            }
+            for (size_t word = 0; word * 64 < bumped; ++word) {
+                fresh[word] = 0;
+            }
+            has_fresh = false;
+            unswept = false;
+        }
+    };
+
+    struct SizeClass {
+        std::vector<Slab*> slabs;
+        // Allocation fills slabs in order; current is slabs[cursor] or null.
+        Slab* current = nullptr;
+        size_t cursor = 0;
+        size_t previous_in_use = 0;
+        // Slabs in use when BeginSweep was called.
+        size_t sweep_in_use = 0;
+    };
+
+    static Slab* SlabOf(void* cell) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(cell) & ~(kSlabSize - 1));
+    }
+
+    template <class F>
+    size_t SweepSlabs(F& dead, bool fresh_only) {
+        unswept_.clear();
+        size_t live = 0;
+        for (SizeClass& cls : classes_) {
+            size_t in_use = 0;
+            for (Slab* slab : cls.slabs) {
+                in_use += slab->live > 0;
+                if (!fresh_only || slab->has_fresh) {
+                    slab->Sweep(dead, fresh_only);
+                }
+                live += slab->live;
+            }
+            ReleaseEmpty(cls, in_use);
+        }
+        return live;
+    }
+
+    void* AllocateSlow(SizeClass& cls, size_t size);
+    void ReleaseEmpty(SizeClass& cls, size_t in_use);
+
+    void* owner_;
+    SizeClass classes_[kMaxSize / kGranule];
+    std::vector<Slab*> unswept_;
+    size_t release_limit_ = SIZE_MAX;
+};
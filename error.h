@@ -13,3 +13,13 @@ struct RuntimeError : public std::runtime_error {
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
+
+// The heap reached its limit and a collection could not bring it back under it.
+struct OutOfMemoryError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// A heap image that this build cannot load: truncated, corrupt, or naming a builtin it lacks.
+struct ImageError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
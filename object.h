@@ -1,83 +1,655 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <arena.h>
 #include <error.h>
 struct Enviromnent;
 class Heap;
+class Symbol;
+
+// What an Object* points to. The first three are not heap objects: the empty list is nullptr, and
+// fixnums and booleans are immediates (see IsImmediate). Obtain it with TypeOf.
+enum class ObjectType : uint8_t {
+    EMPTY,
+    FIXNUM,
+    BOOLEAN,
+    NUMBER,
+    SYMBOL,
+    CELL,
+    BUILD_FUNCTION,
+    LAMBDA_FUNCTION,
+    ENVIRONMENT,
+    // What compaction leaves behind in the old place of an object it moved; see Forwarded.
+    FORWARDED
+};
+
 class Object {
 public:
     virtual ~Object() = default;
     virtual Object* Eval(Enviromnent& env) = 0;
     virtual Object* Clone(Heap& heap) = 0;
 
+    ObjectType GetType() const {
+        return type_;
+    }
+
+    // Mark bits are atomic so that several threads can mark at once; the relaxed accesses compile
+    // to plain loads and stores.
     bool IsMarked() const {
-        return marked_;
+        return marked_.load(std::memory_order_relaxed);
     }
 
-    virtual void Mark() {
-        if (marked_) {
-            return;
-        }
-        marked_ = true;
-        for (Object* dep : dependencies_) {
-            if (dep) {
-                dep->Mark();
-            }
-        }
+    void SetMarked() {
+        marked_.store(true, std::memory_order_relaxed);
+    }
+
+    // Marks the object and returns true, unless it was marked already, by this or another thread.
+    bool TryMark() {
+        return !IsMarked() && !marked_.exchange(true, std::memory_order_relaxed);
     }
 
     void Unmark() {
-        marked_ = false;
+        marked_.store(false, std::memory_order_relaxed);
+    }
+
+    // Objects that survived a collection are old. Minor collections neither trace nor free them.
+    bool IsOld() const {
+        return old_;
+    }
+
+    void Promote() {
+        old_ = true;
+    }
+
+    // The write barrier: every store of an Object* into a heap object that already exists must
+    // be followed by a call to RecordWrite on that object. An old object that comes to point to
+    // a young one is remembered, and minor collections trace it as a root.
+    void RecordWrite(Object* value);
+
+    bool IsRemembered() const {
+        return remembered_;
+    }
+
+    void Forget() {
+        remembered_ = false;
     }
 
 protected:
-    Object() : marked_(false) {
+    explicit Object(ObjectType type) : marked_(false), type_(type) {
+    }
+    // A copy is a new object: unmarked and young.
+    Object(const Object& other) : Object(other.type_) {
     }
 
-    void AddDependency(Object* obj) {
-        if (obj) {
-            dependencies_.push_back(obj);
-        }
+private:
+    std::atomic<bool> marked_;
+    ObjectType type_;
+    bool old_ = false;
+    bool remembered_ = false;
+};
+
+// Small integers and booleans are encoded in the Object* itself instead of being allocated. A set
+// low bit marks a fixnum carrying its value in the upper 63 bits; 0b010 is #f and 0b110 is #t.
+// Heap objects are at least 8-byte aligned, so their pointers always have the low bits clear.
+// Immediates must not be dereferenced: go through As/Is and the helpers below.
+inline bool IsImmediate(const Object* obj) {
+    return reinterpret_cast<uintptr_t>(obj) & 3;
+}
+
+inline bool IsFixnum(const Object* obj) {
+    return reinterpret_cast<uintptr_t>(obj) & 1;
+}
+
+inline bool FitsFixnum(int64_t value) {
+    return value >= -(int64_t{1} << 62) && value < (int64_t{1} << 62);
+}
+
+inline Object* MakeFixnum(int64_t value) {
+    return reinterpret_cast<Object*>(static_cast<uintptr_t>(value) << 1 | 1);
+}
+
+inline int64_t FixnumValue(const Object* obj) {
+    return static_cast<int64_t>(reinterpret_cast<uintptr_t>(obj)) >> 1;
+}
+
+inline bool IsBooleanImmediate(const Object* obj) {
+    return (reinterpret_cast<uintptr_t>(obj) & 3) == 2;
+}
+
+inline Object* MakeBoolean(bool value) {
+    return reinterpret_cast<Object*>(uintptr_t{value ? 6u : 2u});
+}
+
+inline bool BooleanValue(const Object* obj) {
+    return reinterpret_cast<uintptr_t>(obj) & 4;
+}
+
+// Only objects from a heap's arena are ever promoted, so remembering them can mark their slab.
+inline void Object::RecordWrite(Object* value) {
+    if (old_ && !remembered_ && value && !IsImmediate(value) && !value->old_) {
+        remembered_ = true;
+        Arena::MarkDirty(this);
     }
+}
 
-    void RemoveDependency(Object* obj) {
-        for (int i = 0; i < dependencies_.size(); ++i) {
-            if (dependencies_[i] == obj) {
-                dependencies_.erase(dependencies_.begin() + i);
-                return;
-            }
+inline ObjectType TypeOf(const Object* obj) {
+    if (!obj) {
+        return ObjectType::EMPTY;
+    }
+    if (IsFixnum(obj)) {
+        return ObjectType::FIXNUM;
+    }
+    if (IsBooleanImmediate(obj)) {
+        return ObjectType::BOOLEAN;
+    }
+    return obj->GetType();
+}
+
+// Immediates evaluate to themselves; the empty list is not a valid expression.
+inline Object* Eval(Object* expr, Enviromnent& env) {
+    if (!expr) {
+        throw RuntimeError("");
+    }
+    if (IsImmediate(expr)) {
+        return expr;
+    }
+    return expr->Eval(env);
+}
+
+inline Object* CloneObject(Object* obj, Heap& heap) {
+    return obj && !IsImmediate(obj) ? obj->Clone(heap) : obj;
+}
+
+
+// Maps each distinct name to exactly one Symbol with a dense integer id (its index in creation
+// order). Symbols are owned by the table and live as long as it does. Interning takes a mutex so
+// that heaps reading in parallel can share one table.
+class SymbolTable {
+public:
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+    ~SymbolTable();
+
+    Symbol* Intern(std::string_view name);
+
+    // The symbol with the given id, which must have been interned.
+    Symbol* At(uint32_t id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return by_id_[id];
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return by_id_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    // Keys view the names stored in the symbols themselves.
+    std::unordered_map<std::string_view, Symbol*> by_name_;
+    std::vector<Symbol*> by_id_;
+};
+
+// Counts the pauses of a heap's collections by length, in power-of-two buckets: bucket 0 holds
+// pauses shorter than 1 us, and bucket i the ones from 2^(i-1) up to 2^i us.
+class PauseHistogram {
+public:
+    static constexpr size_t kBuckets = 24;
+
+    void Record(std::chrono::nanoseconds pause) {
+        uint64_t us = pause.count() / 1000;
+        size_t bucket = 0;
+        while (us > 0 && bucket + 1 < kBuckets) {
+            us >>= 1;
+            ++bucket;
         }
+        ++counts_[bucket];
+        ++total_;
+        max_ = std::max(max_, pause);
+    }
+
+    uint64_t Count(size_t bucket) const {
+        return counts_[bucket];
+    }
+
+    uint64_t Total() const {
+        return total_;
+    }
+
+    std::chrono::nanoseconds Max() const {
+        return max_;
     }
 
 private:
-    bool marked_;
-    std::vector<Object*> dependencies_;
+    uint64_t counts_[kBuckets] = {};
+    uint64_t total_ = 0;
+    std::chrono::nanoseconds max_{0};
+};
+
+// What a heap holds and what its collections cost, as returned by Heap::Stats. Fixnums and
+// booleans are immediates and never take memory, so they never count, and neither do numbers that
+// fit a fixnum.
+struct HeapStats {
+    struct Usage {
+        uint64_t objects = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct TypeStats {
+        // What the heap holds now: the survivors of the last collection and everything allocated
+        // since, which includes garbage no collection has freed yet.
+        Usage live;
+        // Everything allocated over the lifetime of the heap.
+        Usage total;
+    };
+
+    static constexpr size_t kTypes = static_cast<size_t>(ObjectType::FORWARDED) + 1;
+    // The types that can be allocated, by the names reports use for them. Booleans never are, but
+    // are listed for completeness.
+    static constexpr std::pair<ObjectType, const char*> kTypeNames[] = {
+        {ObjectType::NUMBER, "number"},
+        {ObjectType::BOOLEAN, "boolean"},
+        {ObjectType::SYMBOL, "symbol"},
+        {ObjectType::CELL, "pair"},
+        {ObjectType::LAMBDA_FUNCTION, "lambda"},
+        {ObjectType::BUILD_FUNCTION, "builtin"},
+        {ObjectType::ENVIRONMENT, "environment"},
+    };
+
+    // Indexed by ObjectType. Symbols are counted in their table, once interned, which may be shared
+    // with other heaps.
+    TypeStats types[kTypes];
+    // Since the heap was created.
+    std::chrono::nanoseconds lifetime{0};
+    // Bytes allocated per second of lifetime.
+    double allocation_rate = 0;
+
+    uint64_t minor_collections = 0;
+    // Full collections that marked and swept, concurrently or not.
+    uint64_t full_collections = 0;
+    uint64_t compactions = 0;
+    // The time spent in each phase, summed over all collections. Marking includes the time of the
+    // concurrent marker, and sweeping that of the sweep done by Make.
+    std::chrono::nanoseconds mark_time{0};
+    std::chrono::nanoseconds sweep_time{0};
+    std::chrono::nanoseconds compaction_time{0};
+    uint64_t pauses = 0;
+    std::chrono::nanoseconds max_pause{0};
+
+    const TypeStats& operator[](ObjectType type) const {
+        return types[static_cast<size_t>(type)];
+    }
+
+    // Summed over all types.
+    Usage Live() const;
+    Usage Total() const;
+
+    // A JSON object with the fields above, the types under their names, and the totals. Durations
+    // are in nanoseconds and the allocation rate in bytes per second.
+    std::string ToJson() const;
 };
 
 class Heap {
 public:
-    Heap() = default;
+    Heap() : own_symbols_(std::make_unique<SymbolTable>()), symbols_(own_symbols_.get()) {
+    }
+    // A heap interning into another heap's symbol table, so that the two can be spliced.
+    explicit Heap(SymbolTable* symbols) : symbols_(symbols) {
+    }
     Heap(const Heap&) = delete;
     Heap& operator=(const Heap&) = delete;
-    ~Heap() {
-        for (Object* obj : objects_) {
-            delete obj;
-        }
-    }
+    ~Heap();
     template <class T, class... Args>
     T* Make(Args&&... args) {
         static_assert(std::is_base_of<Object, T>::value, "нужно наследование от Object");
-        T* obj = new T(std::forward<Args>(args)...);
-        objects_.push_back(obj);
+        static_assert(sizeof(T) <= Arena::kMaxSize && alignof(T) <= Arena::kGranule);
+        if (arena_.IsSweeping()) {
+            SweepLazily(kSweepStep);
+        }
+        if (allocated_since_collect_ >= limit_check_at_) {
+            CheckLimit();
+        }
+        void* cell = arena_.Allocate(sizeof(T));
+        T* obj;
+        try {
+            obj = new (cell) T(std::forward<Args>(args)...);
+        } catch (...) {
+            arena_.Free(cell);
+            throw;
+        }
+        ++allocated_since_collect_;
+        ++stats_.types[static_cast<size_t>(T::kType)].total.objects;
+        if (marking_) {
+            // Objects allocated while marking runs are not part of the snapshot it traces.
+            obj->SetMarked();
+        }
         return obj;
     }
 
-    void Collect(Enviromnent& global_env);
-    void MarkFromEnv(Enviromnent& env);
+    Symbol* Intern(std::string_view name) {
+        return symbols_->Intern(name);
+    }
+
+    SymbolTable* Symbols() {
+        return symbols_;
+    }
+
+    // Bytes of memory held for objects.
+    size_t Footprint() const {
+        return arena_.SlabCount() * Arena::kSlabSize;
+    }
+
+    // True once the nursery is full: enough objects were allocated since the last collection that
+    // collecting the young generation is worth it. During incremental marking, true once the
+    // next slice is due.
+    bool ShouldCollect() const {
+        return allocated_since_collect_ >= collect_at_;
+    }
+
+    // Limits on the memory the heap holds, in bytes of slabs as Footprint counts them, and on the
+    // objects it holds, garbage included; SIZE_MAX, the default, is no limit. Once the heap is
+    // over a limit, the next safepoint collects in full and throws OutOfMemoryError if it still
+    // is. Make throws it, without collecting, if the heap gets a quarter over a limit before a
+    // safepoint comes. Either way, what the program held is freed so that the interpreter can go
+    // on: by the collection that ends a Run or RunProgram, and after an Execute, which does not
+    // collect when it ends, by the full collection at the first safepoint of whatever runs next.
+    void SetMemoryLimit(size_t bytes) {
+        memory_limit_ = bytes;
+        limit_check_at_ = 0;
+    }
+
+    void SetObjectLimit(size_t objects) {
+        object_limit_ = objects;
+        limit_check_at_ = 0;
+    }
+
+    // Takes ownership of every object allocated in other, leaving it empty. Both heaps must share
+    // one symbol table. The objects count as allocated here, so like Make this may throw
+    // OutOfMemoryError when they take the heap a quarter over a limit.
+    void Splice(Heap& other);
+
+    // Keeps obj alive until Unpin. Returns the index under which Pinned finds it again, even once
+    // compaction has moved it.
+    size_t Pin(Object* obj) {
+        if (!free_pins_.empty()) {
+            size_t index = free_pins_.back();
+            free_pins_.pop_back();
+            pinned_[index] = obj;
+            return index;
+        }
+        pinned_.push_back(obj);
+        return pinned_.size() - 1;
+    }
+
+    // Lets the object pinned under index be collected; Pin may hand the index out again.
+    void Unpin(size_t index) {
+        pinned_[index] = nullptr;
+        free_pins_.push_back(index);
+    }
+
+    Object* Pinned(size_t index) const {
+        return index < pinned_.size() ? pinned_[index] : nullptr;
+    }
+
+    // Everything not reachable from global_env, from roots, from a pinned object or from what is
+    // registered with LocalRoots and FrameRoot is freed.
+    void Collect(Enviromnent& global_env, const std::vector<Object*>& roots = {});
+
+    // Like Collect, but moves the survivors into fresh slabs, in the depth-first order of the
+    // objects they point to, so that the cells of a list end up one after the other. Only the
+    // pointers the heap knows of are updated: the global environment, what is pinned and what
+    // LocalRoots holds. No frame may be registered, so the program must not be running.
+    void Compact(Enviromnent& global_env);
+
+    // In compaction mode, full collections that CollectYoung runs while no frame is registered
+    // compact.
+    void SetCompaction(bool enable) {
+        compaction_ = enable;
+    }
+
+    // In concurrent mode, the full collections that CollectYoung starts mark on a background
+    // thread while the program keeps running. The program stops only to scan the roots when
+    // marking starts and, after the marker is done, to mark what changed meanwhile. Minor
+    // collections are skipped until then. The sweep is done afterwards, a slab per Make.
+    void SetConcurrentMarking(bool enable);
+
+    // In incremental mode, the full collections that CollectYoung starts mark in slices of about
+    // slice each, one per CollectYoung, which safepoints call every few thousand allocations
+    // until marking is done; the sweep is done afterwards, a slab per Make. No pause of a full
+    // collection then takes much longer than slice or than scanning the roots. Zero, the
+    // default, turns the mode off; concurrent marking takes precedence over it.
+    void SetIncrementalMarking(std::chrono::nanoseconds slice) {
+        mark_slice_ = slice;
+        LimitPauses();
+    }
+
+    bool IsMarking() const {
+        return marking_;
+    }
+
+    // Full collections that stop the program mark and sweep with this many threads, the
+    // program's own included; 1, the default, collects on the program's thread alone.
+    void SetCollectorThreads(size_t threads) {
+        collector_threads_ = std::max<size_t>(threads, 1);
+    }
+
+    // Abandons a marking in progress: waits for the marker, if any, without sweeping and clears
+    // every mark, so that the heap is as if the marking never started. Must be called before the
+    // global environment is destroyed, which the marker may still be reading.
+    void CancelMarking();
+
+    // The snapshot-at-the-beginning barrier: while marking runs, every Object* about to be
+    // overwritten in a heap object is passed here, so that the marker still sees it.
+    void Shade(Object* old_value) {
+        if (marking_ && old_value && !IsImmediate(old_value)) {
+            ShadeSlow(old_value);
+        }
+    }
+
+    // Sets a variable of a heap scope while the marker may be reading its table.
+    void SetDuringMarking(Enviromnent* scope, uint32_t id, Object* value);
+
+    const PauseHistogram& Pauses() const {
+        return pauses_;
+    }
+
+    // Walks the arena to count what it holds, so it takes time in proportion to the heap.
+    HeapStats Stats();
+
+    // A minor collection: frees what was allocated since the last collection and is unreachable
+    // from the same roots, and promotes the rest. Objects that are already old are neither traced
+    // nor freed, unless the old generation has doubled since the last full collection, in which
+    // case this is a full collection. Most objects die young, so this costs about as much as the
+    // young objects that survive.
+    void CollectYoung(Enviromnent& global_env, const std::vector<Object*>& roots = {});
+
+    // Called by the evaluator at points where every live temporary is registered as a root.
+    // Collects once the allocation volume calls for it; env is any scope of the running program.
+    void Safepoint(Enviromnent& env) {
+        if (ShouldCollect()) {
+            CollectAt(env);
+        }
+    }
+
+    // Keeps the objects held in C++ locals alive, while in scope, across collections that run at
+    // safepoints. The slots are read when the collection happens, so the locals may change.
+    // Registrations form a list threaded through the C++ stack, so they never allocate.
+    class LocalRoots {
+    public:
+        LocalRoots(Heap& heap, Object** slots, size_t count)
+            : heap_(heap), slots_(slots), count_(count), next_(heap.local_roots_) {
+            heap_.local_roots_ = this;
+        }
+        LocalRoots(Heap& heap, Object*& slot) : LocalRoots(heap, &slot, 1) {
+        }
+        LocalRoots(const LocalRoots&) = delete;
+        LocalRoots& operator=(const LocalRoots&) = delete;
+        ~LocalRoots() {
+            heap_.local_roots_ = next_;
+        }
+
+    private:
+        friend class Heap;
+
+        Heap& heap_;
+        Object** slots_;
+        size_t count_;
+        LocalRoots* next_;
+    };
+
+    // Registers a call frame on the C++ stack for the duration of the call.
+    class FrameRoot {
+    public:
+        FrameRoot(Heap& heap, Enviromnent* frame)
+            : heap_(heap), frame_(frame), next_(heap.frames_) {
+            heap_.frames_ = this;
+        }
+        FrameRoot(const FrameRoot&) = delete;
+        FrameRoot& operator=(const FrameRoot&) = delete;
+        ~FrameRoot() {
+            heap_.frames_ = next_;
+        }
+
+    private:
+        friend class Heap;
+
+        Heap& heap_;
+        Enviromnent* frame_;
+        FrameRoot* next_;
+    };
+
+    // Marks obj and everything reachable from it, without recursion.
+    void Mark(Object* obj);
 
 private:
-    std::vector<Object*> objects_;
+    // Objects allocated between minor collections.
+    static constexpr size_t kNurserySize = 1 << 16;
+    // Objects allocated between slices of incremental marking.
+    static constexpr size_t kSliceInterval = 1 << 12;
+    // Objects a marking slice traces between looks at the clock.
+    static constexpr size_t kSliceCheck = 256;
+    // Slabs each Make sweeps while a sweep is under way.
+    static constexpr size_t kSweepStep = 1;
+    // Objects allocated between checks of the limits, while there are any.
+    static constexpr size_t kLimitCheckInterval = 1 << 12;
+    // Empty slabs of a size class that a sweep returns to the system in the modes above.
+    static constexpr size_t kReleaseStep = 16;
+    static constexpr size_t kMinCollectThreshold = 1 << 16;
+    // Entries of the mark stack. When it is full, objects are marked without being pushed and
+    // found again by a scan of the arena.
+    static constexpr size_t kMarkStackLimit = 1 << 16;
+
+    void PushMark(Object* obj) {
+        if (!obj || IsImmediate(obj) || obj->IsMarked() || (young_only_ && obj->IsOld())) {
+            return;
+        }
+        obj->SetMarked();
+        if (mark_stack_.size() < kMarkStackLimit) {
+            mark_stack_.push_back(obj);
+        } else {
+            mark_overflow_ = true;
+        }
+    }
+    // Objects the mutator shades are handed to the marker in batches of this size.
+    static constexpr size_t kShadeBatch = 256;
+
+    void LimitPauses() {
+        arena_.SetReleaseLimit(concurrent_ || mark_slice_.count() > 0 ? kReleaseStep : SIZE_MAX);
+    }
+
+    void ResetAllocationCount() {
+        allocated_since_collect_ = 0;
+        collect_at_ = kNurserySize;
+        if (limit_check_at_ != SIZE_MAX) {
+            limit_check_at_ = 0;
+        }
+    }
+
+    // hard adds the slack that Make allows before it throws.
+    bool OverLimit(bool hard) const;
+    void CheckLimit();
+
+    void DrainMarkStack();
+    void CollectAt(Enviromnent& env);
+    template <class F>
+    void ForEachRoot(Enviromnent& global_env, const std::vector<Object*>& roots, F&& visit);
+    void MarkRoots(Enviromnent& global_env, const std::vector<Object*>& roots);
+    void CollectFull(Enviromnent& global_env, const std::vector<Object*>& roots);
+    void SweepAll();
+    void ShadeSlow(Object* old_value);
+    void StartMarking(Enviromnent& global_env, const std::vector<Object*>& roots);
+    // Does not count a full collection: Collect and Compact, which finish marking only to start
+    // over, count their own.
+    void FinishMarking();
+    bool DrainGray(std::chrono::steady_clock::time_point deadline =
+                       std::chrono::steady_clock::time_point::max());
+    bool MarkSlice();
+    void SweepLazily(size_t slabs);
+    void GrayShaded(std::vector<Object*>& shaded);
+    void MarkParallel(Enviromnent& global_env, const std::vector<Object*>& roots);
+    void CompactNow(Enviromnent& global_env);
+
+    std::unique_ptr<SymbolTable> own_symbols_;
+    SymbolTable* symbols_;
+    Arena arena_{this};
+    std::vector<Object*> pinned_;
+    std::vector<size_t> free_pins_;
+    std::vector<Object*> mark_stack_;
+    bool mark_overflow_ = false;
+    // Set during a minor collection.
+    bool young_only_ = false;
+    LocalRoots* local_roots_ = nullptr;
+    FrameRoot* frames_ = nullptr;
+    size_t allocated_since_collect_ = 0;
+    size_t collect_at_ = kNurserySize;
+    size_t memory_limit_ = SIZE_MAX;
+    size_t object_limit_ = SIZE_MAX;
+    // When Make checks the limits next; SIZE_MAX while there are none.
+    size_t limit_check_at_ = SIZE_MAX;
+    // Set once the heap is over a limit, until a full collection runs.
+    bool emergency_ = false;
+    // Objects alive after the last collection, all of them old.
+    size_t old_objects_ = 0;
+    size_t full_collect_threshold_ = kMinCollectThreshold;
+
+    size_t collector_threads_ = 1;
+    bool compaction_ = false;
+    bool concurrent_ = false;
+    std::chrono::nanoseconds mark_slice_{0};
+    // Objects found alive so far by the sweep under way.
+    size_t swept_live_ = 0;
+    // Set from the start of a concurrent marking until its sweep.
+    bool marking_ = false;
+    std::thread marker_;
+    std::atomic<bool> marker_done_{false};
+    // Marked objects yet to be traced, owned by the marker while it runs. Unlike mark_stack_ it
+    // is not bounded, since the arena cannot be rescanned while the program allocates.
+    std::vector<Object*> gray_;
+    std::vector<Object*> shaded_;
+    std::mutex shaded_mutex_;
+    std::vector<Object*> shaded_shared_;
+    // Held by the marker while it reads the table of a heap scope, and by the program while it
+    // writes one during marking.
+    std::mutex table_mutex_;
+    PauseHistogram pauses_;
+    // The counters and times of Stats; live usage is counted when asked for.
+    HeapStats stats_;
+    // Written by the marker before it is done, and read after it is joined.
+    std::chrono::nanoseconds marker_time_{0};
+    std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
 };
 struct HeapGuard {
     Heap& heap;
@@ -87,7 +659,7 @@ struct HeapGuard {
     }
 
     ~HeapGuard() {
-        heap.Collect(env);
+        heap.CollectYoung(env);
     }
 };
 ///////////////////////////////////////////////////////////////////////////////
@@ -95,64 +667,231 @@ struct HeapGuard {
 // Runtime type checking and conversion.
 // This can be helpful: https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
 
+// Every concrete class names its type in kType, so a cast is one compare. Abstract classes and
+// immediates specialize ObjectCast.
+template <class T>
+struct ObjectCast {
+    static T* Cast(Object* obj) {
+        return TypeOf(obj) == T::kType ? static_cast<T*>(obj) : nullptr;
+    }
+};
+
+// What As<Number> and As<Boolean> return. Those values are usually immediates with no object
+// behind them, so the cast yields a handle that is tested and dereferenced like a pointer.
+template <class V>
+class ValueRef {
+public:
+    ValueRef() = default;
+    explicit ValueRef(V value) : value_(value), valid_(true) {
+    }
+
+    explicit operator bool() const {
+        return valid_;
+    }
+
+    const ValueRef* operator->() const {
+        return this;
+    }
+
+    V GetValue() const {
+        return value_;
+    }
+
+private:
+    V value_{};
+    bool valid_ = false;
+};
+
 template <class T>
-T* As(Object* obj) {
-    return dynamic_cast<T*>(obj);
+auto As(Object* obj) {
+    return ObjectCast<T>::Cast(obj);
 };
 
 template <class T>
 bool Is(Object* obj) {
-    auto cast = dynamic_cast<T*>(obj);
-    if (cast == nullptr) {
-        return false;
-    }
-    return true;
+    return static_cast<bool>(As<T>(obj));
 }
-struct Enviromnent {
-    std::unordered_map<std::string, Object*> table;
-    Enviromnent* parent_;
-    Heap* heap_;
-    Enviromnent(Heap* h, Enviromnent* parent = nullptr) : parent_(parent), heap_(h) {
+
+// The variables of one scope, keyed by the id of their interned Symbol. Call frames bind a handful
+// of parameters, so the first few entries live inline and are searched linearly without
+// allocating; a scope that outgrows them, like the global environment, moves to a hash map.
+class VarTable {
+public:
+    Object** Find(uint32_t id) {
+        if (spilled_) {
+            auto it = map_.find(id);
+            return it == map_.end() ? nullptr : &it->second;
+        }
+        for (uint32_t i = 0; i < size_; ++i) {
+            if (inline_[i].first == id) {
+                return &inline_[i].second;
+            }
+        }
+        return nullptr;
     }
-    void Set(std::string name, Object* value) {
-        table[name] = std::move(value);
+
+    void Set(uint32_t id, Object* value) {
+        if (Object** slot = Find(id)) {
+            *slot = value;
+        } else if (!spilled_ && size_ < kInline) {
+            inline_[size_++] = {id, value};
+        } else {
+            if (!spilled_) {
+                map_.insert(inline_, inline_ + size_);
+                spilled_ = true;
+            }
+            map_.emplace(id, value);
+        }
     }
-    Object* Get(std::string name) {
-        if (table.find(name) != table.end()) {
-            return table[name];
+
+    // Replaces every value with update(value).
+    template <class F>
+    void Update(F&& update) {
+        if (spilled_) {
+            for (auto& entry : map_) {
+                entry.second = update(entry.second);
+            }
+            return;
         }
-        if (parent_) {
-            return parent_->Get(name);
+        for (uint32_t i = 0; i < size_; ++i) {
+            inline_[i].second = update(inline_[i].second);
         }
-        throw NameError("");
     }
-    void Assign(const std::string& name, Object* value) {
-        Enviromnent* cur = this;
-        while (cur) {
-            auto it = cur->table.find(name);
-            if (it != cur->table.end()) {
-                it->second = std::move(value);
-                return;
+
+    template <class F>
+    void ForEach(F&& func) const {
+        if (spilled_) {
+            for (const auto& entry : map_) {
+                func(entry.second);
             }
-            cur = cur->parent_;
+            return;
+        }
+        for (uint32_t i = 0; i < size_; ++i) {
+            func(inline_[i].second);
         }
-        throw NameError("");
     }
+
+    // Calls func(id, value) for every variable, in no particular order.
+    template <class F>
+    void ForEachEntry(F&& func) const {
+        if (spilled_) {
+            for (const auto& entry : map_) {
+                func(entry.first, entry.second);
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < size_; ++i) {
+            func(inline_[i].first, inline_[i].second);
+        }
+    }
+
+private:
+    static constexpr uint32_t kInline = 4;
+
+    std::pair<uint32_t, Object*> inline_[kInline];
+    uint32_t size_ = 0;
+    bool spilled_ = false;
+    std::unordered_map<uint32_t, Object*> map_;
+};
+
+// A scope. Call frames live on the C++ stack for the duration of the call. A closure created in one
+// must outlive it, so Capture() moves the frame's variables into a heap-allocated Enviromnent that
+// the frame forwards to from then on, and which the closures share. The global environment is
+// owned by the interpreter.
+struct Enviromnent : Object {
+    static constexpr ObjectType kType = ObjectType::ENVIRONMENT;
+
+    VarTable table;
+    Enviromnent* parent_;
+    Heap* heap_;
+    Enviromnent* forward_ = nullptr;
+    bool on_heap_ = false;
+
+    Enviromnent(Heap* h, Enviromnent* parent = nullptr)
+        : Object(kType), parent_(parent), heap_(h) {
+    }
+    void Set(Symbol* name, Object* value);
+    void Set(std::string_view name, Object* value) {
+        Set(heap_->Intern(name), value);
+    }
+    Object* Get(Symbol* name);
+    void Assign(Symbol* name, Object* value);
+    Enviromnent* Capture();
+
+    Object* Eval(Enviromnent&) override {
+        throw RuntimeError("");
+    }
+
+    Object* Clone(Heap&) override {
+        return this;
+    }
+
+    template <class F>
+    void Trace(F&& visit) const {
+        table.ForEach(visit);
+        visit(parent_);
+        visit(forward_);
+    }
+
+    template <class F>
+    void UpdatePointers(F&& update) {
+        table.Update(update);
+        parent_ = static_cast<Enviromnent*>(update(parent_));
+        forward_ = static_cast<Enviromnent*>(update(forward_));
+    }
+};
+
+// The unevaluated operands of a call: a view of storage owned by the caller.
+class ArgList {
+public:
+    ArgList(Object* const* data, size_t size) : data_(data), size_(size) {
+    }
+    ArgList(const std::vector<Object*>& args) : data_(args.data()), size_(args.size()) {
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    Object* operator[](size_t i) const {
+        return data_[i];
+    }
+
+    Object* const* begin() const {
+        return data_;
+    }
+
+    Object* const* end() const {
+        return data_ + size_;
+    }
+
+private:
+    Object* const* data_;
+    size_t size_;
 };
 
 struct Callable : Object {
-    virtual Object* Apply(const std::vector<Object*>& args, Enviromnent& env) = 0;
+    virtual Object* Apply(ArgList args, Enviromnent& env) = 0;
     Object* Eval(Enviromnent& env) override {
         return this;
     }
+
+protected:
+    using Object::Object;
 };
 class BuildFunction : public Callable {
 public:
-    using FuncPtr = Object* (*)(const std::vector<Object*>&, Enviromnent&);
-    explicit BuildFunction(FuncPtr func) : func_(func) {
+    static constexpr ObjectType kType = ObjectType::BUILD_FUNCTION;
+
+    using FuncPtr = Object* (*)(ArgList, Enviromnent&);
+    explicit BuildFunction(FuncPtr func) : Callable(kType), func_(func) {
     }
 
-    Object* Apply(const std::vector<Object*>& args, Enviromnent& env) override {
+    Object* Apply(ArgList args, Enviromnent& env) override {
         return func_(args, env);
     }
 
@@ -163,45 +902,45 @@ public:
         return heap.Make<BuildFunction>(func_);
     }
 
+    FuncPtr GetFunction() const {
+        return func_;
+    }
+
 private:
     FuncPtr func_;
 };
 class LambdaFunction : public Callable {
 public:
-    LambdaFunction(const std::vector<std::string>& params, const std::vector<Object*>& body,
+    static constexpr ObjectType kType = ObjectType::LAMBDA_FUNCTION;
+
+    LambdaFunction(const std::vector<Symbol*>& params, const std::vector<Object*>& body,
                    Enviromnent* env)
-        : params_(params), body_(body) {
-        if (env->parent_ == nullptr) {
-            env_ = env;
-        } else {
-            owned_env_ = std::make_unique<Enviromnent>(*env);
-            owned_env_->heap_ = env->heap_;
-            env_ = owned_env_.get();
-        }
-        for (int i = 0; i < static_cast<int>(body_.size()); ++i) {
-            AddDependency(body_[i]);
-        }
+        : Callable(kType), env_(env->Capture()), params_(params), body_(body) {
     }
 
-    void BindSelf(const std::string& name, Object* self) {
-        env_->Set(name, self);
+    // Restores a closure from an image: env is taken as it is rather than captured, since it may
+    // still be a placeholder until the image is linked. See UpdatePointers.
+    LambdaFunction(Enviromnent* env, std::vector<Symbol*> params, std::vector<Object*> body)
+        : Callable(kType), env_(env), params_(std::move(params)), body_(std::move(body)) {
     }
 
-    Object* Apply(const std::vector<Object*>& args, Enviromnent& call_env) override {
+    Object* Apply(ArgList args, Enviromnent& call_env) override {
         if (args.size() != params_.size()) {
             throw RuntimeError("");
         }
 
         Enviromnent local_env(env_->heap_, env_);
+        Heap::FrameRoot frame_root(*env_->heap_, &local_env);
 
         for (int i = 0; i < static_cast<int>(params_.size()); ++i) {
-            Object* v = args[i]->Eval(call_env);
+            Object* v = ::Eval(args[i], call_env);
             local_env.Set(params_[i], v);
         }
+        env_->heap_->Safepoint(local_env);
 
         Object* result = nullptr;
         for (int i = 0; i < static_cast<int>(body_.size()); ++i) {
-            result = body_[i]->Eval(local_env);
+            result = ::Eval(body_[i], local_env);
         }
         return result;
     }
@@ -213,51 +952,70 @@ public:
     Object* Clone(Heap& heap) override {
         std::vector<Object*> new_body;
         for (int i = 0; i < static_cast<int>(body_.size()); ++i) {
-            new_body.push_back(body_[i]->Clone(heap));
+            new_body.push_back(CloneObject(body_[i], heap));
         }
         return heap.Make<LambdaFunction>(params_, new_body, env_);
     }
 
-    void Mark() override {
-        if (IsMarked()) {
-            return;
+    template <class F>
+    void Trace(F&& visit) const {
+        for (Object* expr : body_) {
+            visit(expr);
         }
-        Object::Mark();
+        visit(env_);
+    }
 
-        Enviromnent* cur = env_;
-        while (cur) {
-            for (auto it = cur->table.begin(); it != cur->table.end(); ++it) {
-                Object* obj = it->second;
-                if (obj) {
-                    obj->Mark();
-                }
-            }
-            cur = cur->parent_;
+    template <class F>
+    void UpdatePointers(F&& update) {
+        for (Object*& expr : body_) {
+            expr = update(expr);
         }
+        env_ = static_cast<Enviromnent*>(update(env_));
+    }
+
+    Enviromnent* GetEnv() const {
+        return env_;
+    }
+
+    const std::vector<Symbol*>& GetParams() const {
+        return params_;
+    }
+
+    const std::vector<Object*>& GetBody() const {
+        return body_;
     }
 
 private:
     Enviromnent* env_;
-    std::unique_ptr<Enviromnent> owned_env_;
-    std::vector<std::string> params_;
+    std::vector<Symbol*> params_;
     std::vector<Object*> body_;
 };
 
+template <>
+struct ObjectCast<Callable> {
+    static Callable* Cast(Object* obj) {
+        ObjectType type = TypeOf(obj);
+        if (type == ObjectType::BUILD_FUNCTION || type == ObjectType::LAMBDA_FUNCTION) {
+            return static_cast<Callable*>(obj);
+        }
+        return nullptr;
+    }
+};
+
+// A number that does not fit a fixnum. Create numbers with MakeNumber.
 class Number : public Object {
     int64_t value_;
 
 public:
-    explicit Number(int64_t value) : value_(value) {
+    static constexpr ObjectType kType = ObjectType::NUMBER;
+
+    explicit Number(int64_t value) : Object(kType), value_(value) {
     }
 
     int64_t GetValue() const {
         return value_;
     }
 
-    void SetValue(int64_t value) {
-        value_ = value;
-    }
-
     Object* Eval(Enviromnent&) override {
         return this;
     }
@@ -265,130 +1023,335 @@ public:
     Object* Clone(Heap& heap) override {
         return heap.Make<Number>(value_);
     }
-
-    void Mark() override {
-        if (IsMarked()) {
-            return;
-        }
-        Object::Mark();
-    }
 };
 
-class Boolean : public Object {
-    bool value_;
-
-public:
-    explicit Boolean(bool value) : value_(value) {
-    }
-
-    bool GetValue() const {
-        return value_;
-    }
+inline Object* MakeNumber(Heap& heap, int64_t value) {
+    return FitsFixnum(value) ? MakeFixnum(value) : heap.Make<Number>(value);
+}
 
-    Object* Eval(Enviromnent&) override {
-        return this;
+template <>
+struct ObjectCast<Number> {
+    static ValueRef<int64_t> Cast(Object* obj) {
+        switch (TypeOf(obj)) {
+            case ObjectType::FIXNUM:
+                return ValueRef<int64_t>(FixnumValue(obj));
+            case ObjectType::NUMBER:
+                return ValueRef<int64_t>(static_cast<Number*>(obj)->GetValue());
+            default:
+                return {};
+        }
     }
+};
 
-    Object* Clone(Heap& heap) override {
-        return heap.Make<Boolean>(value_);
-    }
+// #t and #f are always immediates (see MakeBoolean); Boolean only names their type for As and Is.
+class Boolean;
 
-    void Mark() override {
-        if (IsMarked()) {
-            return;
+template <>
+struct ObjectCast<Boolean> {
+    static ValueRef<bool> Cast(Object* obj) {
+        if (IsBooleanImmediate(obj)) {
+            return ValueRef<bool>(BooleanValue(obj));
         }
-        Object::Mark();
+        return {};
     }
 };
 
+// Symbols are interned: a SymbolTable holds exactly one Symbol per name, so symbols compare by
+// pointer. Obtain them with Heap::Intern.
 class Symbol : public Object {
     std::string name_;
+    uint32_t id_;
 
-public:
-    explicit Symbol(const std::string& name) : name_(name) {
+    friend class SymbolTable;
+    Symbol(std::string_view name, uint32_t id) : Object(kType), name_(name), id_(id) {
     }
 
+public:
+    static constexpr ObjectType kType = ObjectType::SYMBOL;
+
     const std::string& GetName() const {
         return name_;
     }
 
+    uint32_t GetId() const {
+        return id_;
+    }
+
     Object* Eval(Enviromnent& env) override {
-        return env.Get(name_);
+        return env.Get(this);
     }
 
-    Object* Clone(Heap& heap) override {
-        return heap.Make<Symbol>(name_);
+    // Owned by the symbol table rather than the heap, so never collected.
+    Object* Clone(Heap&) override {
+        return this;
+    }
+};
+
+// A heap frame and the global environment never forward, so only the first scope of a lookup can.
+// The global environment and frames on the stack are roots, scanned when marking starts, so only
+// writes to heap frames need the marking barrier.
+inline void Enviromnent::Set(Symbol* name, Object* value) {
+    Enviromnent* scope = forward_ ? forward_ : this;
+    if (scope->on_heap_ && heap_->IsMarking()) {
+        heap_->SetDuringMarking(scope, name->GetId(), value);
+    } else {
+        scope->table.Set(name->GetId(), value);
+    }
+    scope->RecordWrite(value);
+}
+
+inline Object* Enviromnent::Get(Symbol* name) {
+    for (Enviromnent* cur = forward_ ? forward_ : this; cur; cur = cur->parent_) {
+        if (Object** slot = cur->table.Find(name->GetId())) {
+            return *slot;
+        }
     }
+    throw NameError("");
+}
 
-    void Mark() override {
-        if (IsMarked()) {
+inline void Enviromnent::Assign(Symbol* name, Object* value) {
+    for (Enviromnent* cur = forward_ ? forward_ : this; cur; cur = cur->parent_) {
+        if (Object** slot = cur->table.Find(name->GetId())) {
+            if (cur->on_heap_ && heap_->IsMarking()) {
+                heap_->SetDuringMarking(cur, name->GetId(), value);
+            } else {
+                *slot = value;
+            }
+            cur->RecordWrite(value);
             return;
         }
-        Object::Mark();
     }
-};
+    throw NameError("");
+}
+
+inline Enviromnent* Enviromnent::Capture() {
+    if (on_heap_ || !parent_) {
+        return this;
+    }
+    if (!forward_) {
+        forward_ = heap_->Make<Enviromnent>(heap_, parent_);
+        forward_->on_heap_ = true;
+        forward_->table = std::move(table);
+    }
+    return forward_;
+}
 
+// Cells are always allocated by a heap, which a concurrent marker may trace while they change:
+// hence atomic fields, whose relaxed loads and release stores compile to plain moves.
 class Cell : public Object {
-    Object* first_;
-    Object* second_;
+    std::atomic<Object*> first_;
+    std::atomic<Object*> second_;
+
+    // Calls with more operands than this gather them in a vector instead of on the stack.
+    static constexpr size_t kInlineOperands = 8;
+
+    Heap& OwningHeap() {
+        return *static_cast<Heap*>(Arena::OwnerOf(this));
+    }
 
 public:
-    Cell(Object* first, Object* second) : first_(first), second_(second) {
-        AddDependency(first_);
-        AddDependency(second_);
+    static constexpr ObjectType kType = ObjectType::CELL;
+
+    Cell(Object* first, Object* second) : Object(kType), first_(first), second_(second) {
     }
 
     Object* GetFirst() const {
-        return first_;
+        return first_.load(std::memory_order_relaxed);
     }
 
     Object* GetSecond() const {
-        return second_;
+        return second_.load(std::memory_order_relaxed);
     }
 
     void SetFirst(Object* first) {
-        RemoveDependency(first_);
-        first_ = first;
-        AddDependency(first_);
+        OwningHeap().Shade(GetFirst());
+        first_.store(first, std::memory_order_release);
+        RecordWrite(first);
     }
 
     void SetSecond(Object* second) {
-        RemoveDependency(second_);
-        second_ = second;
-        AddDependency(second_);
+        OwningHeap().Shade(GetSecond());
+        second_.store(second, std::memory_order_release);
+        RecordWrite(second);
     }
 
     Object* Eval(Enviromnent& env) override {
-        if (!first_) {
+        Object* first = GetFirst();
+        if (!first) {
             throw RuntimeError("");
         }
-        Object* func_obj = first_->Eval(env);
+        Object* func_obj = ::Eval(first, env);
         if (Callable* func = As<Callable>(func_obj)) {
-            std::vector<Object*> args;
-            Object* second = second_;
+            // A closure made by the operator expression may be referenced from nowhere else.
+            Heap::LocalRoots func_root(*env.heap_, func_obj);
+            Object* operands[kInlineOperands];
+            std::vector<Object*> spilled;
+            size_t count = 0;
+            Object* second = GetSecond();
             while (second) {
                 Cell* pair = As<Cell>(second);
                 if (!pair) {
                     throw RuntimeError("");
                 }
-                args.push_back(pair->GetFirst());
+                if (count < kInlineOperands) {
+                    operands[count] = pair->GetFirst();
+                } else {
+                    if (count == kInlineOperands) {
+                        spilled.assign(operands, operands + kInlineOperands);
+                    }
+                    spilled.push_back(pair->GetFirst());
+                }
+                ++count;
                 second = pair->GetSecond();
             }
-            return func->Apply(args, env);
+            if (count > kInlineOperands) {
+                return func->Apply(spilled, env);
+            }
+            return func->Apply(ArgList(operands, count), env);
         }
         throw RuntimeError("");
     }
 
     Object* Clone(Heap& heap) override {
-        Object* f = first_ ? first_->Clone(heap) : nullptr;
-        Object* s = second_ ? second_->Clone(heap) : nullptr;
-        return heap.Make<Cell>(f, s);
+        return heap.Make<Cell>(CloneObject(GetFirst(), heap), CloneObject(GetSecond(), heap));
     }
 
-    void Mark() override {
-        if (IsMarked()) {
-            return;
-        }
-        Object::Mark();
+    template <class F>
+    void Trace(F&& visit) const {
+        visit(first_.load(std::memory_order_acquire));
+        visit(second_.load(std::memory_order_acquire));
+    }
+
+    template <class F>
+    void UpdatePointers(F&& update) {
+        first_.store(update(GetFirst()), std::memory_order_relaxed);
+        second_.store(update(GetSecond()), std::memory_order_relaxed);
+    }
+};
+
+// Compaction moves an object by constructing a copy elsewhere, destroying the original and
+// leaving this in its place, until the old slabs are released. The program never sees one.
+class Forwarded : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::FORWARDED;
+
+    explicit Forwarded(Object* target) : Object(kType), target_(target) {
+    }
+
+    Object* GetTarget() const {
+        return target_;
+    }
+
+    Object* Eval(Enviromnent&) override {
+        throw RuntimeError("");
+    }
+
+    Object* Clone(Heap&) override {
+        throw RuntimeError("");
     }
+
+private:
+    Object* target_;
 };
+
+// Calls visit with every Object* that the heap object obj holds, which may include nullptr and
+// immediates. This is all the collector knows about the layout of each type.
+template <class Visitor>
+void TraceObject(Object* obj, Visitor&& visit) {
+    switch (obj->GetType()) {
+        case ObjectType::CELL:
+            static_cast<Cell*>(obj)->Trace(visit);
+            break;
+        case ObjectType::LAMBDA_FUNCTION:
+            static_cast<LambdaFunction*>(obj)->Trace(visit);
+            break;
+        case ObjectType::ENVIRONMENT:
+            static_cast<Enviromnent*>(obj)->Trace(visit);
+            break;
+        default:
+            // Numbers, symbols and builtins hold no references.
+            break;
+    }
+}
+
+// Replaces every Object* that the heap object obj holds with update(pointer); the counterpart of
+// TraceObject for collectors that move objects.
+template <class F>
+void UpdateObject(Object* obj, F&& update) {
+    switch (obj->GetType()) {
+        case ObjectType::CELL:
+            static_cast<Cell*>(obj)->UpdatePointers(update);
+            break;
+        case ObjectType::LAMBDA_FUNCTION:
+            static_cast<LambdaFunction*>(obj)->UpdatePointers(update);
+            break;
+        case ObjectType::ENVIRONMENT:
+            static_cast<Enviromnent*>(obj)->UpdatePointers(update);
+            break;
+        default:
+            break;
+    }
+}
+
+// Ends the lifetime of a heap object before its cell is reused. Cells, numbers, builtins and
+// forwarding stubs own no resources, so their destructors are skipped.
+inline void DestroyObject(Object* obj) {
+    switch (obj->GetType()) {
+        case ObjectType::CELL:
+        case ObjectType::NUMBER:
+        case ObjectType::BUILD_FUNCTION:
+        case ObjectType::FORWARDED:
+            break;
+        default:
+            obj->~Object();
+            break;
+    }
+}
+
+// The size of the cell an object of the given type takes.
+inline size_t ObjectSize(ObjectType type) {
+    switch (type) {
+        case ObjectType::NUMBER:
+            return sizeof(Number);
+        case ObjectType::CELL:
+            return sizeof(Cell);
+        case ObjectType::BUILD_FUNCTION:
+            return sizeof(BuildFunction);
+        case ObjectType::LAMBDA_FUNCTION:
+            return sizeof(LambdaFunction);
+        case ObjectType::ENVIRONMENT:
+            return sizeof(Enviromnent);
+        default:
+            throw RuntimeError("");
+    }
+}
+
+// Moves obj, a heap object, into cell, which must be ObjectSize bytes, and leaves a Forwarded in
+// its place. The copy is unmarked and young.
+inline Object* RelocateObject(Object* obj, void* cell) {
+    Object* moved;
+    switch (obj->GetType()) {
+        case ObjectType::NUMBER:
+            moved = new (cell) Number(*static_cast<Number*>(obj));
+            break;
+        case ObjectType::CELL: {
+            auto* pair = static_cast<Cell*>(obj);
+            moved = new (cell) Cell(pair->GetFirst(), pair->GetSecond());
+            break;
+        }
+        case ObjectType::BUILD_FUNCTION:
+            moved = new (cell) BuildFunction(*static_cast<BuildFunction*>(obj));
+            break;
+        case ObjectType::LAMBDA_FUNCTION:
+            moved = new (cell) LambdaFunction(std::move(*static_cast<LambdaFunction*>(obj)));
+            break;
+        case ObjectType::ENVIRONMENT:
+            moved = new (cell) Enviromnent(std::move(*static_cast<Enviromnent*>(obj)));
+            break;
+        default:
+            throw RuntimeError("");
+    }
+    DestroyObject(obj);
+    new (obj) Forwarded(moved);
+    return moved;
+}
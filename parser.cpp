@@ -1,72 +1,354 @@
 #include <parser.h>
-static Heap default_heap;
-static Heap* current_heap = &default_heap;
 
-void SetCurrentHeap(Heap* h) {
-    if (h) {
-        current_heap = h;
-    } else {
-        current_heap = &default_heap;
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace {
+
+// Adapters presenting the streaming tokenizer and a pre-lexed TokenStream through one interface.
+// Kind() throws SyntaxError at the end of input, like Tokenizer::GetToken().
+struct TokenizerCursor {
+    Tokenizer* tokenizer;
+
+    TokenKind Kind() {
+        const Token& token = tokenizer->GetToken();
+        if (std::holds_alternative<ConstantToken>(token)) {
+            return TokenKind::CONSTANT;
+        }
+        if (std::holds_alternative<SymbolToken>(token)) {
+            return TokenKind::SYMBOL;
+        }
+        if (const BracketToken* b = std::get_if<BracketToken>(&token)) {
+            return *b == BracketToken::OPEN ? TokenKind::OPEN : TokenKind::CLOSE;
+        }
+        if (std::holds_alternative<BooleanToken>(token)) {
+            return TokenKind::BOOLEAN;
+        }
+        if (std::holds_alternative<QuoteToken>(token)) {
+            return TokenKind::QUOTE;
+        }
+        return TokenKind::DOT;
     }
-}
-Object* ReadListWrap(Tokenizer* tokenizer, Heap& heap) {
-    Token token = tokenizer->GetToken();
-    if (BracketToken* t = std::get_if<BracketToken>(&token)) {
-        if (*t == BracketToken::CLOSE) {
-            tokenizer->Next();
-            return nullptr;
+    int64_t Value() {
+        const Token& token = tokenizer->GetToken();
+        if (const ConstantToken* c = std::get_if<ConstantToken>(&token)) {
+            return c->value;
         }
+        return std::get<BooleanToken>(token).f;
+    }
+    std::string_view Name() {
+        return std::get<SymbolToken>(tokenizer->GetToken()).name;
     }
-    Object* first = ReadWrap(tokenizer,heap);
-    Token next_token = tokenizer->GetToken();
-    if (std::get_if<DotToken>(&next_token)) {
+    void Next() {
         tokenizer->Next();
-        Object* second = ReadWrap(tokenizer, heap);
-        Token closing = tokenizer->GetToken();
-        BracketToken* x = std::get_if<BracketToken>(&closing);
-        if (!x || *x != BracketToken::CLOSE) {
+    }
+};
+
+struct TokenStreamCursor {
+    const TokenStream& tokens;
+    size_t* pos;
+
+    TokenKind Kind() {
+        if (*pos >= tokens.Size()) {
             throw SyntaxError("");
         }
-        tokenizer->Next();
-        return heap.Make<Cell>(first, second);
-    } else {
-        Object* next = ReadListWrap(tokenizer, heap);
-        return heap.Make<Cell>(first, next);
+        return tokens.kind[*pos];
+    }
+    int64_t Value() {
+        return tokens.payload[*pos];
+    }
+    std::string_view Name() {
+        return tokens.Name(*pos);
+    }
+    void Next() {
+        ++*pos;
     }
 };
+
+// Reads one datum without recursion. Open lists and pending quotes live on an explicit stack, and
+// each list is built front to back through its tail cell, so neither the length nor the nesting
+// depth of the input is limited by the native stack. With list_open the opening bracket is taken
+// as already consumed and the rest of that list is read.
+template <class Cursor>
+Object* ReadDatum(Cursor& cursor, Heap& heap, bool list_open) {
+    struct Frame {
+        // LIST expects an element, a dot or ')'; DOTTED expects the datum after a dot; CLOSE
+        // expects the ')' after it.
+        enum State { QUOTE, LIST, DOTTED, CLOSE } state;
+        Cell* head = nullptr;
+        Cell* tail = nullptr;
+    };
+    std::vector<Frame> stack;
+    if (list_open) {
+        stack.push_back({Frame::LIST});
+    }
+
+    while (true) {
+        TokenKind kind = cursor.Kind();
+        Frame* frame = stack.empty() ? nullptr : &stack.back();
+        if (frame && frame->state == Frame::CLOSE && kind != TokenKind::CLOSE) {
+            throw SyntaxError("");
+        }
+        if (frame && frame->state == Frame::LIST && kind == TokenKind::DOT) {
+            if (!frame->head) {
+                throw SyntaxError("");
+            }
+            cursor.Next();
+            frame->state = Frame::DOTTED;
+            continue;
+        }
+
+        Object* value;
+        switch (kind) {
+            case TokenKind::CONSTANT:
+                value = MakeNumber(heap, cursor.Value());
+                break;
+            case TokenKind::SYMBOL:
+                value = heap.Intern(cursor.Name());
+                break;
+            case TokenKind::BOOLEAN:
+                value = MakeBoolean(cursor.Value() != 0);
+                break;
+            case TokenKind::QUOTE:
+                cursor.Next();
+                stack.push_back({Frame::QUOTE});
+                continue;
+            case TokenKind::OPEN:
+                cursor.Next();
+                stack.push_back({Frame::LIST});
+                continue;
+            case TokenKind::CLOSE:
+                if (!frame || (frame->state != Frame::LIST && frame->state != Frame::CLOSE)) {
+                    throw SyntaxError("");
+                }
+                value = frame->head;
+                stack.pop_back();
+                break;
+            default:
+                throw SyntaxError("");
+        }
+        // Advance only after the object is built: a symbol token's name refers to tokenizer state.
+        cursor.Next();
+
+        while (!stack.empty() && stack.back().state == Frame::QUOTE) {
+            stack.pop_back();
+            Symbol* quote = heap.Intern("quote");
+            value = heap.Make<Cell>(quote, heap.Make<Cell>(value, nullptr));
+        }
+        if (stack.empty()) {
+            return value;
+        }
+        Frame& parent = stack.back();
+        if (parent.state == Frame::DOTTED) {
+            parent.tail->SetSecond(value);
+            parent.state = Frame::CLOSE;
+            continue;
+        }
+        Cell* cell = heap.Make<Cell>(value, nullptr);
+        if (parent.tail) {
+            parent.tail->SetSecond(cell);
+        } else {
+            parent.head = cell;
+        }
+        parent.tail = cell;
+    }
+}
+
+}  // namespace
+
+Object* ReadListWrap(Tokenizer* tokenizer, Heap& heap) {
+    TokenizerCursor cursor{tokenizer};
+    return ReadDatum(cursor, heap, true);
+}
+
 Object* ReadWrap(Tokenizer* tokenizer, Heap& heap) {
-    Token token = tokenizer->GetToken();
-    if (ConstantToken* c = std::get_if<ConstantToken>(&token)) {
-        tokenizer->Next();
-        return heap.Make<Number>(c->value);
+    TokenizerCursor cursor{tokenizer};
+    return ReadDatum(cursor, heap, false);
+}
+
+Object* Read(Tokenizer* tokenizer, Heap& heap) {
+    return ReadWrap(tokenizer, heap);
+}
+
+Object* Read(Tokenizer* tokenizer) {
+    thread_local Heap default_heap;
+    return ReadWrap(tokenizer, default_heap);
+}
+
+Object* ReadTokens(const TokenStream& tokens, size_t* pos, Heap& heap) {
+    TokenStreamCursor cursor{tokens, pos};
+    return ReadDatum(cursor, heap, false);
+}
+
+std::vector<Object*> ReadAllTokens(const TokenStream& tokens, Heap& heap) {
+    std::vector<Object*> result;
+    for (size_t pos = 0; pos < tokens.Size();) {
+        result.push_back(ReadTokens(tokens, &pos, heap));
     }
+    return result;
+}
 
-    if (SymbolToken* s = std::get_if<SymbolToken>(&token)) {
-        tokenizer->Next();
+namespace {
+
+// Chunks below this size are not worth a thread.
+constexpr size_t kMinParallelChunk = 64 << 10;
 
-        return heap.Make<Symbol>(s->name);
+// Splits source into about `count` pieces, cutting only right after a ')' that closes a top-level
+// list. The tokenizer has no strings or comments, so bracket balance alone is exact.
+std::vector<std::string_view> SplitTopLevel(std::string_view source, size_t count) {
+    std::vector<std::string_view> chunks;
+    size_t target = std::max(source.size() / count, kMinParallelChunk);
+    size_t begin = 0;
+    int depth = 0;
+    for (size_t i = 0; i < source.size(); ++i) {
+        if (source[i] == '(') {
+            ++depth;
+        } else if (source[i] == ')' && --depth <= 0) {
+            depth = 0;
+            if (i + 1 - begin >= target) {
+                chunks.push_back(source.substr(begin, i + 1 - begin));
+                begin = i + 1;
+            }
+        }
     }
-    if (BooleanToken* b = std::get_if<BooleanToken>(&token)) {
-        tokenizer->Next();
-        return heap.Make<Boolean>(b->f);
+    if (begin < source.size()) {
+        chunks.push_back(source.substr(begin));
     }
-    if (std::get_if<QuoteToken>(&token)) {
-        tokenizer->Next();
-        Object* quote = ReadWrap(tokenizer,heap);
+    return chunks;
+}
+
+}  // namespace
 
-        Symbol* first = heap.Make<Symbol>("quote");
-        Cell* second = heap.Make<Cell>(quote, nullptr);
-        return heap.Make<Cell>(first, second);
+std::vector<Object*> ReadParallel(std::string_view source, Heap& heap, size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
     }
-    if (BracketToken* t = std::get_if<BracketToken>(&token)) {
-        tokenizer->Next();
-        if (*t == BracketToken::OPEN) {
-            return ReadListWrap(tokenizer,heap);
+    std::vector<std::string_view> chunks = SplitTopLevel(source, threads);
+    if (chunks.size() <= 1 || threads == 1) {
+        return ReadAllTokens(Tokenize(source), heap);
+    }
+    threads = std::min(threads, chunks.size());
+
+    std::vector<std::vector<Object*>> results(chunks.size());
+    std::vector<std::exception_ptr> errors(chunks.size());
+    // The thread heaps intern into heap's own symbol table, so splicing needs no fix-ups.
+    std::vector<std::unique_ptr<Heap>> heaps;
+    for (size_t i = 0; i < threads; ++i) {
+        heaps.push_back(std::make_unique<Heap>(heap.Symbols()));
+    }
+    std::atomic<size_t> next_chunk{0};
+    auto work = [&](Heap& local_heap) {
+        for (size_t i; (i = next_chunk.fetch_add(1)) < chunks.size();) {
+            try {
+                results[i] = ReadAllTokens(Tokenize(chunks[i]), local_heap);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(work, std::ref(*heaps[i]));
+    }
+    work(*heaps[0]);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
         }
+    }
+    for (std::unique_ptr<Heap>& local_heap : heaps) {
+        heap.Splice(*local_heap);
+    }
+    std::vector<Object*> objects;
+    for (std::vector<Object*>& chunk : results) {
+        objects.insert(objects.end(), chunk.begin(), chunk.end());
+    }
+    return objects;
+}
+
+std::vector<Object*> IncrementalReader::Feed(std::string_view bytes) {
+    pending_.append(bytes.data(), bytes.size());
+    for (; scanned_ < pending_.size(); ++scanned_) {
+        char ch = pending_[scanned_];
+        if (ch == '(' || ch == ')' || ch == '\'' || charclass::Is(ch, charclass::kSpace)) {
+            if (in_atom_) {
+                boundaries_.push_back(scanned_);
+                in_atom_ = false;
+            }
+            if (ch == '(') {
+                ++depth_;
+            } else if (ch == ')') {
+                // A stray ')' at top level forms a datum of its own, which the parser rejects.
+                depth_ = depth_ > 0 ? depth_ - 1 : 0;
+                if (depth_ == 0) {
+                    boundaries_.push_back(scanned_ + 1);
+                }
+            }
+        } else if (depth_ == 0) {
+            in_atom_ = true;
+        }
+    }
+    return ParseReady(boundaries_.empty() ? 0 : boundaries_.back());
+}
+
+std::vector<Object*> IncrementalReader::Finish() {
+    if (depth_ > 0) {
+        pending_.clear();
+        scanned_ = 0;
+        boundaries_.clear();
+        depth_ = 0;
+        in_atom_ = false;
         throw SyntaxError("");
     }
-    throw SyntaxError("");
-};
-Object* Read(Tokenizer* tokenizer) {
-    return ReadWrap(tokenizer, *current_heap);
+    // Whatever is left (a trailing atom, or a dangling quote) is parsed as the last datum.
+    if (HasPending()) {
+        boundaries_.push_back(pending_.size());
+    }
+    in_atom_ = false;
+    return ParseReady(pending_.size());
+}
+
+bool IncrementalReader::HasPending() const {
+    for (char ch : pending_) {
+        if (!charclass::Is(ch, charclass::kSpace)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Object*> IncrementalReader::ParseReady(size_t end) {
+    std::vector<Object*> result;
+    result.swap(ready_);
+    size_t begin = 0;
+    try {
+        for (size_t boundary : boundaries_) {
+            std::string_view datum = std::string_view{pending_}.substr(begin, boundary - begin);
+            begin = boundary;
+            // Adjacent atoms such as "1a" share a segment, so read until the segment is exhausted.
+            for (Tokenizer tokenizer{datum}; !tokenizer.IsEnd();) {
+                result.push_back(ReadWrap(&tokenizer, heap_));
+            }
+        }
+    } catch (const SyntaxError&) {
+        ready_.swap(result);
+        boundaries_.erase(boundaries_.begin(),
+                          std::find(boundaries_.begin(), boundaries_.end(), begin) + 1);
+        for (size_t& boundary : boundaries_) {
+            boundary -= begin;
+        }
+        pending_.erase(0, begin);
+        scanned_ -= begin;
+        throw;
+    }
+    boundaries_.clear();
+    pending_.erase(0, end);
+    scanned_ -= end;
+    return result;
 }
@@ -1,10 +1,60 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include <object.h>
 #include <tokenizer.h>
 Object* ReadListWrap(Tokenizer* tokenizer,Heap& heap);
 Object* ReadWrap(Tokenizer* tokenizer,Heap& heap);
+Object* Read(Tokenizer* tokenizer, Heap& heap);
+// Reads into a per-thread heap owned by the reader, which is only freed when the thread exits. Kept
+// for tools and tests that only inspect the parse tree; the interpreter always passes its own heap.
+// The reader has no other shared state, so both overloads may be called from any number of
+// threads.
 Object* Read(Tokenizer* tokenizer);
-void SetCurrentHeap(Heap* h);
+
+// Parser variant over a pre-lexed TokenStream. Reads one datum starting at *pos and advances *pos
+// past it.
+Object* ReadTokens(const TokenStream& tokens, size_t* pos, Heap& heap);
+std::vector<Object*> ReadAllTokens(const TokenStream& tokens, Heap& heap);
+
+// Reads every top-level datum of source, in order. The source is cut into chunks at top-level
+// bracket boundaries, the chunks are parsed concurrently into per-thread heaps, and those heaps are
+// spliced into heap once all of them succeed. Otherwise the error of the earliest failing chunk is
+// rethrown. threads == 0 means one per hardware thread; small sources are read on the calling
+// thread.
+std::vector<Object*> ReadParallel(std::string_view source, Heap& heap, size_t threads = 0);
+
+// Push-style reader for input that arrives in arbitrary chunks, e.g. from a pipe. Feed() returns
+// every datum completed by the new bytes and keeps the unfinished tail (a partial token or an open
+// list) until the next call. Only the bracket depth and the current top-level atom are tracked
+// while bytes arrive; each datum is parsed once, after its closing byte has been seen.
+class IncrementalReader {
+public:
+    explicit IncrementalReader(Heap& heap) : heap_(heap) {
+    }
+
+    // On a syntax error the offending datum is dropped and SyntaxError is thrown. Datums completed
+    // before it are returned by the next call.
+    std::vector<Object*> Feed(std::string_view bytes);
+
+    // Signals end of input: flushes a trailing top-level atom and throws SyntaxError if a datum is
+    // left unfinished. The reader is empty and reusable afterwards.
+    std::vector<Object*> Finish();
+
+    bool HasPending() const;
+
+private:
+    std::vector<Object*> ParseReady(size_t end);
+
+    Heap& heap_;
+    std::string pending_;
+    size_t scanned_ = 0;
+    std::vector<size_t> boundaries_;
+    std::vector<Object*> ready_;
+    int depth_ = 0;
+    bool in_atom_ = false;
+};
@@ -1,10 +1,49 @@
+#include <iomanip>
 #include <iostream>
+#include <memory>
 
 #include <error.h>
 #include <scheme.h>
 
-int main() {
-    Interpreter interpreter;
+namespace {
+
+void PrintUsage(const char* name, const HeapStats::Usage& usage) {
+    std::cout << "  " << std::left << std::setw(12) << name << std::right << std::setw(12)
+              << usage.objects << " objects " << std::setw(14) << usage.bytes << " bytes\n";
+}
+
+void PrintStats(const HeapStats& stats) {
+    for (bool live : {true, false}) {
+        std::cout << (live ? "live:\n" : "allocated in total:\n");
+        for (const auto& [type, name] : HeapStats::kTypeNames) {
+            PrintUsage(name, live ? stats[type].live : stats[type].total);
+        }
+        PrintUsage("all", live ? stats.Live() : stats.Total());
+    }
+    auto ms = [](std::chrono::nanoseconds time) { return time.count() / 1e6; };
+    std::cout << "allocation rate: " << stats.allocation_rate / 1e6 << " MB/s over "
+              << ms(stats.lifetime) / 1e3 << " s\n"
+              << "collections: " << stats.minor_collections << " minor, "
+              << stats.full_collections << " full, " << stats.compactions << " compactions\n"
+              << "mark " << ms(stats.mark_time) << " ms, sweep " << ms(stats.sweep_time)
+              << " ms, compaction " << ms(stats.compaction_time) << " ms\n"
+              << stats.pauses << " pauses, longest " << ms(stats.max_pause) << " ms"
+              << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // Optionally start from an image written by :save instead of a fresh global environment.
+    std::unique_ptr<Interpreter> owned;
+    try {
+        owned = argc > 1 ? std::make_unique<Interpreter>(std::string(argv[1]))
+                         : std::make_unique<Interpreter>();
+    } catch (const std::exception& error) {
+        std::cerr << "Could not load image: " << error.what() << std::endl;
+        return 1;
+    }
+    Interpreter& interpreter = *owned;
     std::string query;
 
     while (true) {
@@ -14,6 +53,23 @@ int main() {
             std::cerr << "Exiting" << std::endl;
             break;
         }
+        // Heap statistics, as a table or as JSON.
+        if (query == ":stats") {
+            PrintStats(interpreter.GcStats());
+            continue;
+        }
+        if (query == ":stats json") {
+            std::cout << interpreter.GcStats().ToJson() << std::endl;
+            continue;
+        }
+        if (query.rfind(":save ", 0) == 0) {
+            try {
+                interpreter.SaveImage(query.substr(6));
+            } catch (const std::exception& error) {
+                std::cerr << "Could not save: " << error.what() << std::endl;
+            }
+            continue;
+        }
 
         try {
             auto result = interpreter.Run(query);
@@ -22,6 +78,8 @@ int main() {
             std::cerr << "Caught SyntaxError: " << syntax_error.what() << std::endl;
         } catch (const NameError& name_error) {
             std::cerr << "Caught NameError: " << name_error.what() << std::endl;
+        } catch (const OutOfMemoryError& out_of_memory) {
+            std::cerr << "Caught OutOfMemoryError: " << out_of_memory.what() << std::endl;
         } catch (const RuntimeError& runtime_error) {
             std::cerr << "Caught RuntimeError: " << runtime_error.what() << std::endl;
         } catch (...) {
@@ -2,229 +2,184 @@
 #include "parser.h"
 
 #include <complex>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
+#include <stdexcept>
+#include <unordered_set>
 #include <error.h>
 #include <numeric>
+#include <algorithm>
 std::string Serialize(Object* result);
-Object* Eval(Object* expr, Enviromnent& env) {
-    if (!expr) {
-        throw RuntimeError("");
+// The operand of an arithmetic builtin, almost always a fixnum.
+int64_t NumberValue(Object* val) {
+    switch (TypeOf(val)) {
+        case ObjectType::FIXNUM:
+            return FixnumValue(val);
+        case ObjectType::NUMBER:
+            return static_cast<Number*>(val)->GetValue();
+        default:
+            throw RuntimeError("");
     }
-    return expr->Eval(env);
 }
 template <class Func>
-Object* Accumulate(const std::vector<Object*>& args, Enviromnent& env, int64_t start,
-                   int start_index, Func func) {
+Object* Accumulate(ArgList args, Enviromnent& env, int64_t start, int start_index, Func func) {
     if (args.empty()) {
         throw RuntimeError("");
     }
     int64_t acc = start;
     for (int i = start_index; i < args.size(); ++i) {
-        Object* val = Eval(args[i], env);
-        Number* n = As<Number>(val);
-        if (!n) {
-            throw RuntimeError("");
-        }
-        acc = func(acc, n->GetValue());
+        acc = func(acc, NumberValue(Eval(args[i], env)));
     }
-    return env.heap_->Make<Number>(acc);
+    return MakeNumber(*env.heap_, acc);
 }
 template <class Func>
-Object* AccumulateBool(const std::vector<Object*>& args, Enviromnent& env, Func func) {
-    Object* first_val = Eval(args[0], env);
-    Number* first_num = As<Number>(first_val);
-    if (!first_num) {
-        throw RuntimeError("");
-    }
-    int64_t prev = first_num->GetValue();
+Object* AccumulateBool(ArgList args, Enviromnent& env, Func func) {
+    int64_t prev = NumberValue(Eval(args[0], env));
     for (int i = 1; i < args.size(); ++i) {
-        Object* val = Eval(args[i], env);
-        Number* n = As<Number>(val);
-        if (!n) {
-            throw RuntimeError("");
-        }
-        int64_t cur = n->GetValue();
+        int64_t cur = NumberValue(Eval(args[i], env));
         if (!func(prev, cur)) {
-            return env.heap_->Make<Boolean>(false);
+            return MakeBoolean(false);
         }
         prev = cur;
     }
 
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
 }
-Object* Plus(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Plus(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Number>(0);
+        return MakeNumber(*env.heap_, 0);
     }
     return Accumulate(args, env, 0, 0, std::plus<int64_t>());
 }
-Object* Mul(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Mul(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Number>(1);
+        return MakeNumber(*env.heap_, 1);
     }
     return Accumulate(args, env, 1, 0, std::multiplies<int64_t>());
 }
-Object* Minus(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Minus(ArgList args, Enviromnent& env) {
     if (args.empty()) {
         throw RuntimeError("");
     }
-    Object* first_val = Eval(args[0], env);
-    Number* first_num = As<Number>(first_val);
-    if (!first_num) {
-        throw RuntimeError("");
-    }
-    int64_t start = first_num->GetValue();
+    int64_t start = NumberValue(Eval(args[0], env));
     if (args.size() == 1) {
-        return env.heap_->Make<Number>(-start);
+        return MakeNumber(*env.heap_, -start);
     }
     return Accumulate(args, env, start, 1, std::minus<int64_t>());
 }
-Object* Del(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Del(ArgList args, Enviromnent& env) {
     if (args.empty()) {
         throw RuntimeError("");
     }
-    Object* first_val = Eval(args[0], env);
-    Number* first_num = As<Number>(first_val);
-    if (!first_num) {
-        throw RuntimeError("");
-    }
-    int64_t start = first_num->GetValue();
+    int64_t start = NumberValue(Eval(args[0], env));
     if (args.size() == 1) {
-        return env.heap_->Make<Number>(1 / start);
+        return MakeNumber(*env.heap_, 1 / start);
     }
     return Accumulate(args, env, start, 1, std::divides<int64_t>());
 }
-Object* Max(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Max(ArgList args, Enviromnent& env) {
     if (args.empty()) {
         throw RuntimeError("");
     }
-    Number* first = As<Number>(Eval(args[0], env));
-    if (!first) {
-        throw RuntimeError("");
-    }
-    int64_t best = first->GetValue();
+    int64_t best = NumberValue(Eval(args[0], env));
     for (int i = 1; i < args.size(); ++i) {
-        Object* val = Eval(args[i], env);
-        Number* n = As<Number>(val);
-        if (!n) {
-            throw RuntimeError("");
-        }
-        if (n->GetValue() > best) {
-            best = n->GetValue();
+        int64_t n = NumberValue(Eval(args[i], env));
+        if (n > best) {
+            best = n;
         }
     }
-    return env.heap_->Make<Number>(best);
+    return MakeNumber(*env.heap_, best);
 }
-Object* Min(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Min(ArgList args, Enviromnent& env) {
     if (args.empty()) {
         throw RuntimeError("");
     }
-    Number* first = As<Number>(Eval(args[0], env));
-    if (!first) {
-        throw RuntimeError("");
-    }
-    int64_t best = first->GetValue();
+    int64_t best = NumberValue(Eval(args[0], env));
     for (int i = 1; i < args.size(); ++i) {
-        Number* n = As<Number>(Eval(args[i], env));
-        if (!n) {
-            throw RuntimeError("");
-        }
-        if (n->GetValue() < best) {
-            best = n->GetValue();
+        int64_t n = NumberValue(Eval(args[i], env));
+        if (n < best) {
+            best = n;
         }
     }
-    return env.heap_->Make<Number>(best);
+    return MakeNumber(*env.heap_, best);
 }
-Object* Abs(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Abs(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    Number* n = As<Number>(Eval(args[0], env));
-    if (!n) {
-        throw RuntimeError("");
-    }
-    return env.heap_->Make<Number>(std::abs(n->GetValue()));
+    int64_t n = NumberValue(Eval(args[0], env));
+    return MakeNumber(*env.heap_, std::abs(n));
 }
-Object* IsNumber(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsNumber(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    Number* n = As<Number>(Eval(args[0], env));
+    auto n = As<Number>(Eval(args[0], env));
     if (!n) {
-        return env.heap_->Make<Boolean>(false);
+        return MakeBoolean(false);
     }
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
 }
-Object* Equal(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Equal(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     return AccumulateBool(args, env, std::equal_to<int64_t>());
 }
-Object* Greater(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Greater(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     return AccumulateBool(args, env, std::greater<int64_t>());
 }
-Object* Less(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Less(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     return AccumulateBool(args, env, std::less<int64_t>());
 }
-Object* GreaterEqual(const std::vector<Object*>& args, Enviromnent& env) {
+Object* GreaterEqual(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     return AccumulateBool(args, env, std::greater_equal<int64_t>());
 }
-Object* LessEqual(const std::vector<Object*>& args, Enviromnent& env) {
+Object* LessEqual(ArgList args, Enviromnent& env) {
     if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     return AccumulateBool(args, env, std::less_equal<int64_t>());
 }
-Object* IsBool(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsBool(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    Boolean* n = As<Boolean>(Eval(args[0], env));
+    auto n = As<Boolean>(Eval(args[0], env));
     if (!n) {
-        return env.heap_->Make<Boolean>(false);
+        return MakeBoolean(false);
     }
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
 }
-Object* Quote(const std::vector<Object*>& args, Enviromnent&) {
+Object* Quote(ArgList args, Enviromnent&) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
     return args[0];
 }
+// Everything except #f is true.
 bool IsTrue(Object* val) {
-    if (Boolean* b = As<Boolean>(val)) {
-        return b->GetValue();
-    }
-    return true;
+    return val != MakeBoolean(false);
 }
-Object* Not(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Not(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    Object* val = Eval(args[0], env);
-    bool flag;
-    if (Boolean* b = As<Boolean>(val)) {
-        flag = b->GetValue();
-    } else {
-        flag = true;
-    }
-    return env.heap_->Make<Boolean>(!flag);
+    return MakeBoolean(!IsTrue(Eval(args[0], env)));
 }
-Object* And(const std::vector<Object*>& args, Enviromnent& env) {
-    if (args.empty()) {
-        return env.heap_->Make<Boolean>(true);
-    }
-    Object* val;
+Object* And(ArgList args, Enviromnent& env) {
+    // The value of the empty form.
+    Object* val = MakeBoolean(true);
     for (Object* expr : args) {
         val = Eval(expr, env);
         if (!IsTrue(val)) {
@@ -233,11 +188,9 @@ Object* And(const std::vector<Object*>& args, Enviromnent& env) {
     }
     return val;
 }
-Object* Or(const std::vector<Object*>& args, Enviromnent& env) {
-    if (args.empty()) {
-        return env.heap_->Make<Boolean>(false);
-    }
-    Object* val;
+Object* Or(ArgList args, Enviromnent& env) {
+    // The value of the empty form.
+    Object* val = MakeBoolean(false);
     for (Object* expr : args) {
         val = Eval(expr, env);
         if (IsTrue(val)) {
@@ -246,25 +199,22 @@ Object* Or(const std::vector<Object*>& args, Enviromnent& env) {
     }
     return val;
 }
-Object* List(const std::vector<Object*>& args, Enviromnent& env) {
+Object* List(ArgList args, Enviromnent& env) {
     Object* ans = nullptr;
-    for (std::vector<Object*>::const_reverse_iterator it = args.rbegin(); it != args.rend(); ++it) {
-        Object* val = Eval(*it, env);
+    Heap::LocalRoots root(*env.heap_, ans);
+    for (size_t i = args.size(); i-- > 0;) {
+        Object* val = Eval(args[i], env);
         ans = env.heap_->Make<Cell>(val, ans);
     }
     return ans;
 }
-Object* ListRef(const std::vector<Object*>& args, Enviromnent& env) {
+Object* ListRef(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw RuntimeError("");
     }
     Object* val = Eval(args[0], env);
-    Object* cnt = Eval(args[1], env);
-    Number* num = As<Number>(cnt);
-    if (!num) {
-        throw RuntimeError("");
-    }
-    int64_t k = num->GetValue();
+    Heap::LocalRoots root(*env.heap_, val);
+    int64_t k = NumberValue(Eval(args[1], env));
     if (k < 0) {
         throw RuntimeError("");
     }
@@ -283,17 +233,13 @@ Object* ListRef(const std::vector<Object*>& args, Enviromnent& env) {
     return cell->GetFirst();
 }
 
-Object* ListTail(const std::vector<Object*>& args, Enviromnent& env) {
+Object* ListTail(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw RuntimeError("");
     }
     Object* val = Eval(args[0], env);
-    Object* cnt = Eval(args[1], env);
-    Number* num = As<Number>(cnt);
-    if (!num) {
-        throw RuntimeError("");
-    }
-    int64_t k = num->GetValue();
+    Heap::LocalRoots root(*env.heap_, val);
+    int64_t k = NumberValue(Eval(args[1], env));
     if (k < 0) {
         throw RuntimeError("");
     }
@@ -308,81 +254,78 @@ Object* ListTail(const std::vector<Object*>& args, Enviromnent& env) {
     return cur;
 }
 
-Object* IsNull(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsNull(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
     Object* val = Eval(args[0], env);
     if (val == nullptr) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
-    return env.heap_->Make<Boolean>(false);
+    return MakeBoolean(false);
 }
-Object* IsPair(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsPair(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
     Object* val = Eval(args[0], env);
     if (Is<Cell>(val)) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
-    return env.heap_->Make<Boolean>(false);
+    return MakeBoolean(false);
 }
-Object* Cons(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Cons(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw RuntimeError("");
     }
     Object* first = Eval(args[0], env);
+    Heap::LocalRoots root(*env.heap_, first);
     Object* second = Eval(args[1], env);
     return env.heap_->Make<Cell>(first, second);
 }
-Object* Car(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Car(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    std::vector<Object*> tmp;
-    tmp.push_back(args[0]);
-    tmp.push_back(env.heap_->Make<Number>(0));
-    return ListRef(tmp, env);
+    Object* operands[] = {args[0], MakeFixnum(0)};
+    return ListRef(ArgList(operands, 2), env);
 }
-Object* Cdr(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Cdr(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
-    std::vector<Object*> tmp;
-    tmp.push_back(args[0]);
-    tmp.push_back(env.heap_->Make<Number>(1));
-    return ListTail(tmp, env);
+    Object* operands[] = {args[0], MakeFixnum(1)};
+    return ListTail(ArgList(operands, 2), env);
 }
-Object* IsList(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsList(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
     Object* val = Eval(args[0], env);
     if (val == nullptr) {
-        return env.heap_->Make<Boolean>(true);
+        return MakeBoolean(true);
     }
     while (Is<Cell>(val)) {
         Cell* valnew = As<Cell>(val);
         val = valnew->GetSecond();
         if (val == nullptr) {
-            return env.heap_->Make<Boolean>(true);
+            return MakeBoolean(true);
         }
     }
-    return env.heap_->Make<Boolean>(false);
+    return MakeBoolean(false);
 }
-Object* IsSymbol(const std::vector<Object*>& args, Enviromnent& env) {
+Object* IsSymbol(ArgList args, Enviromnent& env) {
     if (args.size() != 1) {
         throw RuntimeError("");
     }
     Symbol* n = As<Symbol>(Eval(args[0], env));
     if (!n) {
-        return env.heap_->Make<Boolean>(false);
+        return MakeBoolean(false);
     }
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
 }
 
-Object* Set(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Set(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw SyntaxError("");
     }
@@ -392,54 +335,40 @@ Object* Set(const std::vector<Object*>& args, Enviromnent& env) {
     }
 
     Object* new_value = Eval(args[1], env);
-    const std::string& name = symb->GetName();
-
-    Enviromnent* cur = &env;
-    while (cur) {
-        auto it = cur->table.find(name);
-        if (it != cur->table.end()) {
-            Object* old_value = it->second;
-            Number* old_num = As<Number>(old_value);
-            Number* new_num = As<Number>(new_value);
-            if (old_num && new_num) {
-                old_num->SetValue(new_num->GetValue());
-                return old_num;
-            }
-            it->second = new_value;
-            return new_value;
-        }
-        cur = cur->parent_;
-    }
-
-    throw NameError("");
+    env.Assign(symb, new_value);
+    return new_value;
 }
 
-Object* SetCar(const std::vector<Object*>& args, Enviromnent& env) {
+Object* SetCar(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw SyntaxError("");
     }
-    Cell* symb = As<Cell>(Eval(args[0], env));
+    Object* pair = Eval(args[0], env);
+    Cell* symb = As<Cell>(pair);
     if (!symb) {
         throw SyntaxError("");
     }
+    Heap::LocalRoots root(*env.heap_, pair);
     Object* value = Eval(args[1], env);
     symb->SetFirst(value);
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
 }
-Object* SetCdr(const std::vector<Object*>& args, Enviromnent& env) {
+Object* SetCdr(ArgList args, Enviromnent& env) {
     if (args.size() != 2) {
         throw SyntaxError("");
     }
-    Cell* symb = As<Cell>(Eval(args[0], env));
+    Object* pair = Eval(args[0], env);
+    Cell* symb = As<Cell>(pair);
     if (!symb) {
         throw SyntaxError("");
     }
+    Heap::LocalRoots root(*env.heap_, pair);
     Object* value = Eval(args[1], env);
     symb->SetSecond(value);
-    return env.heap_->Make<Boolean>(true);
+    return MakeBoolean(true);
     ;
 }
-Object* If(const std::vector<Object*>& args, Enviromnent& env) {
+Object* If(ArgList args, Enviromnent& env) {
     if (args.size() == 2) {
         if (IsTrue(Eval(args[0], env))) {
             return Eval(args[1], env);
@@ -454,7 +383,7 @@ Object* If(const std::vector<Object*>& args, Enviromnent& env) {
     }
     throw SyntaxError("");
 }
-Object* Lambda(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Lambda(ArgList args, Enviromnent& env) {
     if (args.size() < 2) {
         throw SyntaxError("");
     }
@@ -462,7 +391,7 @@ Object* Lambda(const std::vector<Object*>& args, Enviromnent& env) {
     if (!params_list && args[0] != nullptr) {
         throw SyntaxError("");
     }
-    std::vector<std::string> params;
+    std::vector<Symbol*> params;
     Object* cur = args[0];
     while (cur) {
         Cell* cell = As<Cell>(cur);
@@ -473,7 +402,7 @@ Object* Lambda(const std::vector<Object*>& args, Enviromnent& env) {
         if (!s) {
             throw SyntaxError("");
         }
-        params.push_back(s->GetName());
+        params.push_back(s);
         cur = cell->GetSecond();
     }
     std::vector<Object*> body;
@@ -482,7 +411,7 @@ Object* Lambda(const std::vector<Object*>& args, Enviromnent& env) {
     }
     return env.heap_->Make<LambdaFunction>(params, body, &env);
 }
-Object* Define(const std::vector<Object*>& args, Enviromnent& env) {
+Object* Define(ArgList args, Enviromnent& env) {
     if (args.size() < 2) {
         throw SyntaxError("");
     }
@@ -491,15 +420,8 @@ Object* Define(const std::vector<Object*>& args, Enviromnent& env) {
         if (args.size() != 2) {
             throw SyntaxError("");
         }
-        Object* value = Eval(args[1], env);
-        Number* num = As<Number>(value);
-        if (num) {
-            Object* stored = value->Clone(*env.heap_);
-            env.Set(first->GetName(), stored);
-        } else {
-            env.Set(first->GetName(), value);
-        }
-        return env.heap_->Make<Boolean>(true);
+        env.Set(first, Eval(args[1], env));
+        return MakeBoolean(true);
     }
     Cell* pair = As<Cell>(args[0]);
     if (!pair) {
@@ -515,83 +437,827 @@ Object* Define(const std::vector<Object*>& args, Enviromnent& env) {
         lambda_args.push_back(args[i]);
     }
     Object* func = Lambda(lambda_args, env);
-    env.Set(fname->GetName(), func);
-    if (auto* lambda = As<LambdaFunction>(func)) {
-        lambda->BindSelf(fname->GetName(), func);
+    env.Set(fname, func);
+    return MakeBoolean(true);
+}
+
+SymbolTable::~SymbolTable() {
+    for (Symbol* symbol : by_id_) {
+        delete symbol;
+    }
+}
+
+Symbol* SymbolTable::Intern(std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_name_.find(name);
+    if (it != by_name_.end()) {
+        return it->second;
+    }
+    Symbol* symbol = new Symbol(name, static_cast<uint32_t>(by_id_.size()));
+    // Symbols live as long as the table, so they are old from the start, and marked for good so
+    // that collectors never write to them.
+    symbol->Promote();
+    symbol->SetMarked();
+    by_id_.push_back(symbol);
+    by_name_.emplace(symbol->GetName(), symbol);
+    return symbol;
+}
+
+namespace {
+
+// Adds the time from its construction to its destruction to total.
+class Stopwatch {
+public:
+    explicit Stopwatch(std::chrono::nanoseconds& total)
+        : total_(total), start_(std::chrono::steady_clock::now()) {
+    }
+    Stopwatch(const Stopwatch&) = delete;
+    Stopwatch& operator=(const Stopwatch&) = delete;
+    ~Stopwatch() {
+        total_ += std::chrono::steady_clock::now() - start_;
+    }
+
+private:
+    std::chrono::nanoseconds& total_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace
+
+Heap::~Heap() {
+    CancelMarking();
+    arena_.Sweep([](void* cell) {
+        DestroyObject(static_cast<Object*>(cell));
+        return true;
+    });
+}
+
+void Heap::Splice(Heap& other) {
+    if (marking_) {
+        // Like objects allocated here, they are not part of the snapshot being marked.
+        other.arena_.ForEach([](void* cell) { static_cast<Object*>(cell)->SetMarked(); });
+    }
+    arena_.Splice(other.arena_);
+    // What other allocated counts as allocated here: towards the next collection, the limits and
+    // the statistics.
+    allocated_since_collect_ += other.old_objects_ + other.allocated_since_collect_;
+    other.old_objects_ = 0;
+    other.allocated_since_collect_ = 0;
+    for (size_t i = 0; i < HeapStats::kTypes; ++i) {
+        stats_.types[i].total.objects += other.stats_.types[i].total.objects;
+        other.stats_.types[i].total.objects = 0;
+    }
+    if (allocated_since_collect_ >= limit_check_at_) {
+        CheckLimit();
     }
-    return env.heap_->Make<Boolean>(true);
 }
 
-void Heap::Collect(Enviromnent& global_env) {
-    for (int i = 0; i < objects_.size(); ++i) {
-        objects_[i]->Unmark();
+template <class F>
+void Heap::ForEachRoot(Enviromnent& global_env, const std::vector<Object*>& roots, F&& visit) {
+    // The global environment and the frames on the C++ stack live outside the arena, so no sweep
+    // clears their marks.
+    global_env.Unmark();
+    visit(&global_env);
+    for (Object* root : roots) {
+        visit(root);
+    }
+    for (Object* root : pinned_) {
+        visit(root);
+    }
+    for (LocalRoots* local = local_roots_; local; local = local->next_) {
+        for (size_t i = 0; i < local->count_; ++i) {
+            visit(local->slots_[i]);
+        }
+    }
+    for (FrameRoot* frame = frames_; frame; frame = frame->next_) {
+        frame->frame_->Unmark();
+        visit(frame->frame_);
     }
+}
 
-    MarkFromEnv(global_env);
+void Heap::MarkRoots(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    ForEachRoot(global_env, roots, [this](Object* root) { Mark(root); });
+}
 
-    int j = 0;
-    for (int i = 0; i < objects_.size(); ++i) {
-        if (!objects_[i]->IsMarked()) {
-            delete objects_[i];
+void Heap::Collect(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    auto start = std::chrono::steady_clock::now();
+    if (marking_) {
+        FinishMarking();
+    }
+    SweepLazily(SIZE_MAX);
+    CollectFull(global_env, roots);
+    pauses_.Record(std::chrono::steady_clock::now() - start);
+}
+
+void Heap::CollectFull(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    {
+        Stopwatch mark(stats_.mark_time);
+        if (collector_threads_ > 1) {
+            MarkParallel(global_env, roots);
         } else {
-            objects_[j] = objects_[i];
-            ++j;
+            MarkRoots(global_env, roots);
         }
     }
-    objects_.resize(j);
+    SweepAll();
+    ++stats_.full_collections;
 }
 
-void Heap::MarkFromEnv(Enviromnent& env) {
-    Enviromnent* cur = &env;
-    while (cur) {
-        for (auto it = cur->table.begin(); it != cur->table.end(); ++it) {
-            Object* obj = it->second;
-            if (obj) {
-                obj->Mark();
+void Heap::SweepAll() {
+    Stopwatch sweep(stats_.sweep_time);
+    // Survivors are unmarked on the way, so that all objects are unmarked between collections.
+    auto dead = [](void* cell) {
+        Object* obj = static_cast<Object*>(cell);
+        if (obj->IsMarked()) {
+            obj->Unmark();
+            obj->Promote();
+            obj->Forget();
+            return false;
+        }
+        DestroyObject(obj);
+        return true;
+    };
+    size_t live = collector_threads_ > 1 ? arena_.SweepParallel(dead, collector_threads_)
+                                         : arena_.Sweep(dead);
+    ResetAllocationCount();
+    old_objects_ = live;
+    full_collect_threshold_ = std::max(kMinCollectThreshold, 2 * live);
+}
+
+void Heap::CollectYoung(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    if (emergency_) {
+        // Over a limit: free everything that can be, and give the memory back.
+        emergency_ = false;
+        Collect(global_env, roots);
+        arena_.Trim();
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (arena_.IsSweeping()) {
+        // Until the sweep is over, what is left to sweep would look alive. Make is done with it
+        // within as many allocations as there are slabs, so minor collections wait for it.
+        SweepLazily(kSweepStep);
+        if (arena_.IsSweeping()) {
+            pauses_.Record(std::chrono::steady_clock::now() - start);
+            return;
+        }
+    }
+    if (marking_) {
+        if (marker_.joinable()) {
+            // The marker owns the mark bits until it is done.
+            if (!marker_done_.load(std::memory_order_acquire)) {
+                return;
+            }
+            FinishMarking();
+            ++stats_.full_collections;
+        } else if (MarkSlice()) {
+            FinishMarking();
+            ++stats_.full_collections;
+        }
+    } else if (old_objects_ >= full_collect_threshold_) {
+        if (compaction_ && !frames_ && roots.empty()) {
+            CompactNow(global_env);
+        } else if (concurrent_ || mark_slice_.count() > 0) {
+            StartMarking(global_env, roots);
+        } else {
+            CollectFull(global_env, roots);
+        }
+    } else {
+        young_only_ = true;
+        {
+            Stopwatch mark(stats_.mark_time);
+            MarkRoots(global_env, roots);
+            // Old objects written to since the last collection may be all that holds some young
+            // ones.
+            auto push = [this](Object* child) { PushMark(child); };
+            arena_.ForEachInDirtySlabs([this, &push](void* cell) {
+                Object* obj = static_cast<Object*>(cell);
+                if (obj->IsRemembered()) {
+                    obj->Forget();
+                    TraceObject(obj, push);
+                    DrainMarkStack();
+                }
+            });
+        }
+        young_only_ = false;
+
+        // No old object can point to a young one that dies, so the survivors are promoted
+        // together.
+        Stopwatch sweep(stats_.sweep_time);
+        size_t live = arena_.SweepFresh([](void* cell) {
+            Object* obj = static_cast<Object*>(cell);
+            if (obj->IsMarked()) {
+                obj->Unmark();
+                obj->Promote();
+                return false;
+            }
+            DestroyObject(obj);
+            return true;
+        });
+        ResetAllocationCount();
+        old_objects_ = live;
+        ++stats_.minor_collections;
+    }
+    if (marking_ && !marker_.joinable()) {
+        // The next slice is due once the program has allocated a little more.
+        collect_at_ = allocated_since_collect_ + kSliceInterval;
+    }
+    pauses_.Record(std::chrono::steady_clock::now() - start);
+}
+
+namespace {
+
+// Marks from a set of roots with several threads. Each keeps the objects it has yet to trace on a
+// private stack and, while it has plenty, offers some in a shared queue of its own, which idle
+// threads steal from. Marking ends when every thread is idle and every queue empty; only busy
+// threads add work, so no work can appear after that.
+class ParallelMarker {
+public:
+    ParallelMarker(size_t threads, std::vector<Object*> roots) : queues_(threads) {
+        queues_[0].items = std::move(roots);
+        queues_[0].size = queues_[0].items.size();
+        pending_ = queues_[0].items.size();
+    }
+
+    void Run() {
+        std::vector<std::thread> helpers;
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            helpers.emplace_back([this, i] { Work(i); });
+        }
+        Work(0);
+        for (std::thread& helper : helpers) {
+            helper.join();
+        }
+    }
+
+private:
+    // A thread shares work once its stack holds this many objects and its queue is empty.
+    static constexpr size_t kShareThreshold = 64;
+
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Object*> items;
+        // items.size(), readable without the lock.
+        std::atomic<size_t> size{0};
+    };
+
+    void Work(size_t self) {
+        std::vector<Object*> stack;
+        auto push = [&stack](Object* child) {
+            if (child && !IsImmediate(child) && child->TryMark()) {
+                stack.push_back(child);
+            }
+        };
+        while (true) {
+            while (!stack.empty()) {
+                Object* obj = stack.back();
+                stack.pop_back();
+                TraceObject(obj, push);
+                if (stack.size() >= kShareThreshold) {
+                    Share(self, stack);
+                }
+            }
+            if (Take(self, stack)) {
+                continue;
+            }
+            idle_.fetch_add(1);
+            while (true) {
+                if (pending_.load() > 0) {
+                    idle_.fetch_sub(1);
+                    if (Take(self, stack)) {
+                        break;
+                    }
+                    idle_.fetch_add(1);
+                } else if (idle_.load() == queues_.size()) {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Moves the older half of stack, which tends to lead to more objects, to the thread's queue.
+    void Share(size_t self, std::vector<Object*>& stack) {
+        Queue& queue = queues_[self];
+        if (queue.size.load(std::memory_order_relaxed) > 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        size_t half = stack.size() / 2;
+        queue.items.insert(queue.items.end(), stack.begin(), stack.begin() + half);
+        stack.erase(stack.begin(), stack.begin() + half);
+        queue.size.store(queue.items.size(), std::memory_order_relaxed);
+        pending_.fetch_add(half);
+    }
+
+    // Takes half of the thread's own queue or, failing that, of another one.
+    bool Take(size_t self, std::vector<Object*>& stack) {
+        for (size_t i = 0; i < queues_.size(); ++i) {
+            Queue& queue = queues_[(self + i) % queues_.size()];
+            if (queue.size.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.items.empty()) {
+                continue;
+            }
+            size_t count = (queue.items.size() + 1) / 2;
+            stack.insert(stack.end(), queue.items.end() - count, queue.items.end());
+            queue.items.resize(queue.items.size() - count);
+            queue.size.store(queue.items.size(), std::memory_order_relaxed);
+            pending_.fetch_sub(count);
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<Queue> queues_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> idle_{0};
+};
+
+}  // namespace
+
+void Heap::MarkParallel(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    std::vector<Object*> gray;
+    ForEachRoot(global_env, roots, [&gray](Object* root) {
+        if (root && !IsImmediate(root) && root->TryMark()) {
+            gray.push_back(root);
+        }
+    });
+    ParallelMarker(collector_threads_, std::move(gray)).Run();
+}
+
+void Heap::Compact(Enviromnent& global_env) {
+    if (frames_) {
+        throw RuntimeError("");
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (marking_) {
+        FinishMarking();
+    }
+    SweepLazily(SIZE_MAX);
+    CompactNow(global_env);
+    pauses_.Record(std::chrono::steady_clock::now() - start);
+}
+
+void Heap::CompactNow(Enviromnent& global_env) {
+    Stopwatch compaction(stats_.compaction_time);
+    ++stats_.compactions;
+    // A Cheney-style copy into fresh slabs, except that the objects still to be scanned wait on a
+    // stack rather than in a queue, so that each is laid out near what it points to. The cells of
+    // a list come out in order, each followed by its element if that is also allocated.
+    Arena to_space(this);
+    std::vector<Object*> pending;
+    size_t moved_count = 0;
+    auto evacuate = [&to_space, &pending, &moved_count](Object* obj) -> Object* {
+        if (!obj || IsImmediate(obj)) {
+            return obj;
+        }
+        switch (obj->GetType()) {
+            case ObjectType::SYMBOL:
+                return obj;
+            case ObjectType::FORWARDED:
+                return static_cast<Forwarded*>(obj)->GetTarget();
+            case ObjectType::ENVIRONMENT:
+                // The global environment is not in the arena, and is updated as a root.
+                if (!static_cast<Enviromnent*>(obj)->on_heap_) {
+                    return obj;
+                }
+                break;
+            default:
+                break;
+        }
+        Object* moved = RelocateObject(obj, to_space.Allocate(ObjectSize(obj->GetType())));
+        moved->Promote();
+        pending.push_back(moved);
+        ++moved_count;
+        return moved;
+    };
+    auto drain = [&pending, &evacuate] {
+        while (!pending.empty()) {
+            Object* obj = pending.back();
+            pending.pop_back();
+            UpdateObject(obj, evacuate);
+        }
+    };
+
+    global_env.Unmark();
+    UpdateObject(&global_env, evacuate);
+    drain();
+    for (Object*& root : pinned_) {
+        root = evacuate(root);
+        drain();
+    }
+    for (LocalRoots* local = local_roots_; local; local = local->next_) {
+        for (size_t i = 0; i < local->count_; ++i) {
+            local->slots_[i] = evacuate(local->slots_[i]);
+            drain();
+        }
+    }
+
+    // What is left in the old slabs is garbage and forwarding stubs.
+    arena_.Swap(to_space);
+    to_space.Sweep([](void* cell) {
+        DestroyObject(static_cast<Object*>(cell));
+        return true;
+    });
+    // The moved objects are old, not fresh.
+    arena_.SweepFresh([](void*) { return false; });
+    ResetAllocationCount();
+    old_objects_ = moved_count;
+    full_collect_threshold_ = std::max(kMinCollectThreshold, 2 * moved_count);
+}
+
+void Heap::CollectAt(Enviromnent& env) {
+    // Every scope chain ends in the global environment.
+    Enviromnent* global_env = &env;
+    while (global_env->parent_) {
+        global_env = global_env->parent_;
+    }
+    bool emergency = emergency_;
+    CollectYoung(*global_env);
+    if (emergency && OverLimit(false)) {
+        // What the program holds does not fit. Once the exception has unwound it, the next
+        // collection frees it.
+        emergency_ = true;
+        throw OutOfMemoryError("");
+    }
+}
+
+bool Heap::OverLimit(bool hard) const {
+    auto over = [hard](size_t usage, size_t limit) {
+        return limit != SIZE_MAX && usage > (hard ? limit + limit / 4 : limit);
+    };
+    return over(Footprint(), memory_limit_) ||
+           over(old_objects_ + allocated_since_collect_, object_limit_);
+}
+
+void Heap::CheckLimit() {
+    if (memory_limit_ == SIZE_MAX && object_limit_ == SIZE_MAX) {
+        limit_check_at_ = SIZE_MAX;
+        return;
+    }
+    if (OverLimit(false)) {
+        emergency_ = true;
+        collect_at_ = 0;
+        if (OverLimit(true)) {
+            // No safepoint came in time to collect.
+            limit_check_at_ = allocated_since_collect_;
+            throw OutOfMemoryError("");
+        }
+    }
+    // Checks again before the object count can pass the next threshold unnoticed. The footprint
+    // grows by whole slabs, so it is only checked every so often.
+    size_t next = kLimitCheckInterval;
+    if (object_limit_ != SIZE_MAX) {
+        size_t threshold = emergency_ ? object_limit_ + object_limit_ / 4 : object_limit_;
+        next = std::min(next, threshold + 1 - (old_objects_ + allocated_since_collect_));
+    }
+    limit_check_at_ = allocated_since_collect_ + next;
+}
+
+void Heap::SetConcurrentMarking(bool enable) {
+    if (!enable && marking_) {
+        auto start = std::chrono::steady_clock::now();
+        FinishMarking();
+        ++stats_.full_collections;
+        pauses_.Record(std::chrono::steady_clock::now() - start);
+    }
+    concurrent_ = enable;
+    LimitPauses();
+}
+
+void Heap::CancelMarking() {
+    if (marker_.joinable()) {
+        marker_.join();
+    }
+    if (marking_) {
+        // Collections take marked objects for traced ones, and objects allocated since marking
+        // began are marked too, so none may stay marked.
+        arena_.ForEach([](void* cell) { static_cast<Object*>(cell)->Unmark(); });
+    }
+    marking_ = false;
+    gray_.clear();
+    shaded_.clear();
+    shaded_shared_.clear();
+}
+
+void Heap::ShadeSlow(Object* old_value) {
+    shaded_.push_back(old_value);
+    if (shaded_.size() >= kShadeBatch) {
+        std::lock_guard<std::mutex> lock(shaded_mutex_);
+        shaded_shared_.insert(shaded_shared_.end(), shaded_.begin(), shaded_.end());
+        shaded_.clear();
+    }
+}
+
+void Heap::SetDuringMarking(Enviromnent* scope, uint32_t id, Object* value) {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    if (Object** slot = scope->table.Find(id)) {
+        Shade(*slot);
+        *slot = value;
+    } else {
+        scope->table.Set(id, value);
+    }
+}
+
+void Heap::StartMarking(Enviromnent& global_env, const std::vector<Object*>& roots) {
+    Stopwatch mark(stats_.mark_time);
+    auto shade = [this](Object* obj) {
+        if (obj && !IsImmediate(obj) && !obj->IsMarked()) {
+            obj->SetMarked();
+            gray_.push_back(obj);
+        }
+    };
+    // The program keeps changing the global environment and the frames on the stack without
+    // barriers, so their contents are snapshotted now; the marker never reads them.
+    ForEachRoot(global_env, roots, [&shade](Object* root) {
+        auto* env = As<Enviromnent>(root);
+        if (env && !env->on_heap_) {
+            env->SetMarked();
+            env->Trace(shade);
+        } else {
+            shade(root);
+        }
+    });
+    marking_ = true;
+    if (!concurrent_) {
+        // Incremental: CollectYoung marks a slice at a time.
+        return;
+    }
+    marker_done_.store(false, std::memory_order_relaxed);
+    marker_ = std::thread([this] {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Object*> batch;
+        while (true) {
+            DrainGray();
+            {
+                std::lock_guard<std::mutex> lock(shaded_mutex_);
+                if (shaded_shared_.empty()) {
+                    break;
+                }
+                batch.swap(shaded_shared_);
+            }
+            GrayShaded(batch);
+        }
+        marker_time_ = std::chrono::steady_clock::now() - start;
+        marker_done_.store(true, std::memory_order_release);
+    });
+}
+
+void Heap::GrayShaded(std::vector<Object*>& shaded) {
+    // Unlike the objects on gray_, shaded ones were not marked when they were pushed.
+    for (Object* obj : shaded) {
+        if (!obj->IsMarked()) {
+            obj->SetMarked();
+            gray_.push_back(obj);
+        }
+    }
+    shaded.clear();
+}
+
+bool Heap::DrainGray(std::chrono::steady_clock::time_point deadline) {
+    auto push = [this](Object* child) {
+        if (child && !IsImmediate(child) && !child->IsMarked()) {
+            child->SetMarked();
+            gray_.push_back(child);
+        }
+    };
+    size_t traced = 0;
+    while (!gray_.empty()) {
+        if (++traced % kSliceCheck == 0 &&
+            deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        Object* obj = gray_.back();
+        gray_.pop_back();
+        if (obj->GetType() == ObjectType::ENVIRONMENT) {
+            std::lock_guard<std::mutex> lock(table_mutex_);
+            TraceObject(obj, push);
+        } else {
+            TraceObject(obj, push);
+        }
+    }
+    return true;
+}
+
+bool Heap::MarkSlice() {
+    Stopwatch mark(stats_.mark_time);
+    auto deadline = std::chrono::steady_clock::now() + mark_slice_;
+    // No marker thread runs, so the batches of shaded objects are only handed over here.
+    GrayShaded(shaded_shared_);
+    GrayShaded(shaded_);
+    return DrainGray(deadline);
+}
+
+void Heap::FinishMarking() {
+    if (marker_.joinable()) {
+        marker_.join();
+        stats_.mark_time += marker_time_;
+    }
+    {
+        Stopwatch mark(stats_.mark_time);
+        // What the program overwrote since the marker last looked.
+        GrayShaded(shaded_shared_);
+        GrayShaded(shaded_);
+        DrainGray();
+    }
+    marking_ = false;
+    // Left to Make, so that the pause ends here.
+    arena_.BeginSweep();
+    swept_live_ = 0;
+    ResetAllocationCount();
+}
+
+void Heap::SweepLazily(size_t slabs) {
+    if (!arena_.IsSweeping()) {
+        return;
+    }
+    Stopwatch sweep(stats_.sweep_time);
+    // Unlike SweepAll, this leaves survivors young. The program may have stored young objects into
+    // them since marking ended, which the barrier does not remember for young objects, so they
+    // must not be promoted before a minor collection traces them.
+    bool done = arena_.SweepSome(
+        [this](void* cell) {
+            Object* obj = static_cast<Object*>(cell);
+            if (obj->IsMarked()) {
+                obj->Unmark();
+                ++swept_live_;
+                return false;
+            }
+            DestroyObject(obj);
+            return true;
+        },
+        slabs);
+    if (done) {
+        old_objects_ = swept_live_;
+        full_collect_threshold_ = std::max(kMinCollectThreshold, 2 * swept_live_);
+    }
+}
+
+void Heap::Mark(Object* obj) {
+    // Roots are pushed onto an empty stack, so they are never left for the overflow scan, which
+    // only sees objects in the arena.
+    PushMark(obj);
+    DrainMarkStack();
+}
+
+void Heap::DrainMarkStack() {
+    auto push = [this](Object* child) { PushMark(child); };
+    auto drain = [this, &push] {
+        while (!mark_stack_.empty()) {
+            Object* obj = mark_stack_.back();
+            mark_stack_.pop_back();
+            TraceObject(obj, push);
+        }
+    };
+    drain();
+    while (mark_overflow_) {
+        // Some marked objects were never traced. Tracing every marked object again pushes their
+        // unmarked children; each pass marks more, so this terminates.
+        mark_overflow_ = false;
+        auto retrace = [&push, &drain](void* cell) {
+            Object* obj = static_cast<Object*>(cell);
+            if (obj->IsMarked()) {
+                TraceObject(obj, push);
+                drain();
             }
+        };
+        // A minor collection only marks young objects, and those are all fresh.
+        if (young_only_) {
+            arena_.ForEachFresh(retrace);
+        } else {
+            arena_.ForEach(retrace);
         }
-        cur = cur->parent_;
     }
 }
 
+HeapStats Heap::Stats() {
+    HeapStats stats = stats_;
+    arena_.ForEach([&stats](void* cell) {
+        ++stats.types[static_cast<size_t>(static_cast<Object*>(cell)->GetType())].live.objects;
+    });
+    HeapStats::TypeStats& symbols = stats.types[static_cast<size_t>(ObjectType::SYMBOL)];
+    symbols.live.objects = symbols.total.objects = symbols_->Size();
+
+    for (size_t i = 0; i < HeapStats::kTypes; ++i) {
+        auto type = static_cast<ObjectType>(i);
+        HeapStats::TypeStats& usage = stats.types[i];
+        if (type == ObjectType::SYMBOL) {
+            usage.live.bytes = usage.live.objects * sizeof(Symbol);
+            usage.total.bytes = usage.total.objects * sizeof(Symbol);
+        } else if (usage.total.objects > 0) {
+            // The cell, rounded up to its size class.
+            size_t size =
+                (ObjectSize(type) + Arena::kGranule - 1) / Arena::kGranule * Arena::kGranule;
+            usage.live.bytes = usage.live.objects * size;
+            usage.total.bytes = usage.total.objects * size;
+        }
+    }
+
+    stats.lifetime = std::chrono::steady_clock::now() - created_;
+    std::chrono::duration<double> seconds = stats.lifetime;
+    stats.allocation_rate = stats.Total().bytes / seconds.count();
+    stats.pauses = pauses_.Total();
+    stats.max_pause = pauses_.Max();
+    return stats;
+}
+
+HeapStats::Usage HeapStats::Live() const {
+    Usage sum;
+    for (const TypeStats& usage : types) {
+        sum.objects += usage.live.objects;
+        sum.bytes += usage.live.bytes;
+    }
+    return sum;
+}
+
+HeapStats::Usage HeapStats::Total() const {
+    Usage sum;
+    for (const TypeStats& usage : types) {
+        sum.objects += usage.total.objects;
+        sum.bytes += usage.total.bytes;
+    }
+    return sum;
+}
+
+std::string HeapStats::ToJson() const {
+    auto usage = [](std::ostringstream& out, const Usage& usage) {
+        out << "{\"objects\":" << usage.objects << ",\"bytes\":" << usage.bytes << "}";
+    };
+    std::ostringstream out;
+    out << "{\"types\":{";
+    for (const auto& [type, name] : kTypeNames) {
+        out << (type == ObjectType::NUMBER ? "" : ",") << "\"" << name << "\":{\"live\":";
+        usage(out, (*this)[type].live);
+        out << ",\"total\":";
+        usage(out, (*this)[type].total);
+        out << "}";
+    }
+    out << "},\"live\":";
+    usage(out, Live());
+    out << ",\"total\":";
+    usage(out, Total());
+    out << ",\"lifetime_ns\":" << lifetime.count()
+        << ",\"allocation_rate\":" << static_cast<uint64_t>(allocation_rate)
+        << ",\"minor_collections\":" << minor_collections
+        << ",\"full_collections\":" << full_collections << ",\"compactions\":" << compactions
+        << ",\"mark_ns\":" << mark_time.count() << ",\"sweep_ns\":" << sweep_time.count()
+        << ",\"compaction_ns\":" << compaction_time.count() << ",\"pauses\":" << pauses
+        << ",\"max_pause_ns\":" << max_pause.count() << "}";
+    return out.str();
+}
+
+namespace {
+
+// Every builtin, by the name the global environment binds it to. Images refer to builtins by these
+// names, and loading one binds those it lacks, so that it loads into any later build: add entries
+// freely, but never rename one.
+const std::pair<const char*, BuildFunction::FuncPtr> kBuiltins[] = {
+    {"+", &Plus},
+    {"-", &Minus},
+    {"*", &Mul},
+    {"/", &Del},
+    {"max", &Max},
+    {"min", &Min},
+    {"abs", &Abs},
+    {"number?", &IsNumber},
+    {"=", &Equal},
+    {">", &Greater},
+    {"<", &Less},
+    {">=", &GreaterEqual},
+    {"<=", &LessEqual},
+    {"boolean?", &IsBool},
+    {"quote", &Quote},
+    {"not", &Not},
+    {"and", &And},
+    {"or", &Or},
+    {"list", &List},
+    {"list-ref", &ListRef},
+    {"list-tail", &ListTail},
+    {"null?", &IsNull},
+    {"pair?", &IsPair},
+    {"list?", &IsList},
+    {"cons", &Cons},
+    {"car", &Car},
+    {"cdr", &Cdr},
+    {"symbol?", &IsSymbol},
+    {"define", &Define},
+    {"set!", &Set},
+    {"set-car!", &SetCar},
+    {"set-cdr!", &SetCdr},
+    {"if", &If},
+    {"lambda", &Lambda},
+};
+
+}  // namespace
+
 Enviromnent MakeGlobalEnv(Heap* heap) {
     Enviromnent env(heap);
-    env.Set("+", env.heap_->Make<BuildFunction>(&Plus));
-    env.Set("-", env.heap_->Make<BuildFunction>(&Minus));
-    env.Set("*", env.heap_->Make<BuildFunction>(&Mul));
-    env.Set("/", env.heap_->Make<BuildFunction>(&Del));
-    env.Set("max", env.heap_->Make<BuildFunction>(&Max));
-    env.Set("min", env.heap_->Make<BuildFunction>(&Min));
-    env.Set("abs", env.heap_->Make<BuildFunction>(&Abs));
-    env.Set("number?", env.heap_->Make<BuildFunction>(&IsNumber));
-    env.Set("=", env.heap_->Make<BuildFunction>(&Equal));
-    env.Set(">", env.heap_->Make<BuildFunction>(&Greater));
-    env.Set("<", env.heap_->Make<BuildFunction>(&Less));
-    env.Set(">=", env.heap_->Make<BuildFunction>(&GreaterEqual));
-    env.Set("<=", env.heap_->Make<BuildFunction>(&LessEqual));
-    env.Set("boolean?", env.heap_->Make<BuildFunction>(&IsBool));
-    env.Set("quote", env.heap_->Make<BuildFunction>(&Quote));
-    env.Set("not", env.heap_->Make<BuildFunction>(&Not));
-    env.Set("and", env.heap_->Make<BuildFunction>(&And));
-    env.Set("or", env.heap_->Make<BuildFunction>(&Or));
-    env.Set("list", env.heap_->Make<BuildFunction>(&List));
-    env.Set("list-ref", env.heap_->Make<BuildFunction>(&ListRef));
-    env.Set("list-tail", env.heap_->Make<BuildFunction>(&ListTail));
-    env.Set("null?", env.heap_->Make<BuildFunction>(&IsNull));
-    env.Set("pair?", env.heap_->Make<BuildFunction>(&IsPair));
-    env.Set("list?", env.heap_->Make<BuildFunction>(&IsList));
-
-    env.Set("cons", env.heap_->Make<BuildFunction>(&Cons));
-    env.Set("car", env.heap_->Make<BuildFunction>(&Car));
-    env.Set("cdr", env.heap_->Make<BuildFunction>(&Cdr));
-    env.Set("symbol?", env.heap_->Make<BuildFunction>(&IsSymbol));
-    env.Set("define", env.heap_->Make<BuildFunction>(&Define));
-    env.Set("set!", env.heap_->Make<BuildFunction>(&Set));
-    env.Set("set-car!", env.heap_->Make<BuildFunction>(&SetCar));
-    env.Set("set-cdr!", env.heap_->Make<BuildFunction>(&SetCdr));
-    env.Set("if", env.heap_->Make<BuildFunction>(&If));
-    env.Set("lambda", env.heap_->Make<BuildFunction>(&Lambda));
-
+    for (const auto& [name, func] : kBuiltins) {
+        env.Set(name, env.heap_->Make<BuildFunction>(func));
+    }
     return env;
 };
 std::string SerializeList(Object* cell) {
@@ -624,39 +1290,473 @@ std::string SerializeList(Object* cell) {
     return res;
 }
 std::string Serialize(Object* result) {
-    if (!result) {
-        return "()";
+    switch (TypeOf(result)) {
+        case ObjectType::EMPTY:
+            return "()";
+        case ObjectType::FIXNUM:
+            return std::to_string(FixnumValue(result));
+        case ObjectType::NUMBER:
+            return std::to_string(static_cast<Number*>(result)->GetValue());
+        case ObjectType::BOOLEAN:
+            return BooleanValue(result) ? "#t" : "#f";
+        case ObjectType::SYMBOL:
+            return static_cast<Symbol*>(result)->GetName();
+        case ObjectType::CELL:
+            return SerializeList(result);
+        default:
+            throw RuntimeError("");
     }
-    if (Number* n = As<Number>(result)) {
-        return std::to_string(n->GetValue());
+}
+namespace {
+
+// An image holds everything reachable from the global environment as a header followed by one
+// record per object, symbols first so that the records after them can name variables and
+// parameters. Numbers are LEB128 varints, and references to objects are encoded so that nothing
+// depends on where they lived: 0 is the empty list, booleans are their immediates, a fixnum is its
+// zigzagged value shifted left with the low bit set, and the index-th record is (index + 1) << 2.
+constexpr char kImageMagic[8] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E'};
+constexpr uint64_t kImageVersion = 1;
+
+uint64_t ZigZag(int64_t value) {
+    return static_cast<uint64_t>(value) << 1 ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class ImageWriter {
+public:
+    ImageWriter(Heap& heap, Enviromnent& global) : heap_(heap) {
+        Discover(&global);
+        // Objects discovered while scanning are appended, so this visits all of them.
+        for (size_t i = 0; i < objects_.size(); ++i) {
+            Scan(objects_[i]);
+        }
+        for (size_t i = 0; i < symbols_.size(); ++i) {
+            index_[symbols_[i]] = i;
+        }
+        for (size_t i = 0; i < objects_.size(); ++i) {
+            index_[objects_[i]] = symbols_.size() + i;
+        }
+
+        out_.append(kImageMagic, sizeof(kImageMagic));
+        Varint(kImageVersion);
+        Varint(index_[&global]);
+        Varint(index_.size());
+        for (Symbol* symbol : symbols_) {
+            out_.push_back(static_cast<char>(ObjectType::SYMBOL));
+            String(symbol->GetName());
+        }
+        for (Object* obj : objects_) {
+            Write(obj);
+        }
+    }
+
+    const std::string& Data() const {
+        return out_;
+    }
+
+private:
+    void Discover(Object* obj) {
+        if (!obj || IsImmediate(obj) || !index_.emplace(obj, 0).second) {
+            return;
+        }
+        if (obj->GetType() == ObjectType::SYMBOL) {
+            symbols_.push_back(static_cast<Symbol*>(obj));
+        } else {
+            objects_.push_back(obj);
+        }
     }
-    if (Boolean* b = As<Boolean>(result)) {
-        return b->GetValue() ? "#t" : "#f";
+
+    void Scan(Object* obj) {
+        if (obj->GetType() == ObjectType::LAMBDA_FUNCTION) {
+            for (Symbol* param : static_cast<LambdaFunction*>(obj)->GetParams()) {
+                Discover(param);
+            }
+        } else if (obj->GetType() == ObjectType::ENVIRONMENT) {
+            static_cast<Enviromnent*>(obj)->table.ForEachEntry(
+                [this](uint32_t id, Object*) { Discover(heap_.Symbols()->At(id)); });
+        }
+        TraceObject(obj, [this](Object* child) { Discover(child); });
+    }
+
+    void Write(Object* obj) {
+        out_.push_back(static_cast<char>(obj->GetType()));
+        switch (obj->GetType()) {
+            case ObjectType::NUMBER:
+                Varint(ZigZag(static_cast<Number*>(obj)->GetValue()));
+                break;
+            case ObjectType::CELL: {
+                auto* cell = static_cast<Cell*>(obj);
+                Ref(cell->GetFirst());
+                Ref(cell->GetSecond());
+                break;
+            }
+            case ObjectType::BUILD_FUNCTION:
+                String(BuiltinName(static_cast<BuildFunction*>(obj)->GetFunction()));
+                break;
+            case ObjectType::LAMBDA_FUNCTION: {
+                auto* lambda = static_cast<LambdaFunction*>(obj);
+                Ref(lambda->GetEnv());
+                Varint(lambda->GetParams().size());
+                for (Symbol* param : lambda->GetParams()) {
+                    Ref(param);
+                }
+                Varint(lambda->GetBody().size());
+                for (Object* expr : lambda->GetBody()) {
+                    Ref(expr);
+                }
+                break;
+            }
+            case ObjectType::ENVIRONMENT: {
+                // Only frames on the stack forward, and none is reachable from here.
+                auto* env = static_cast<Enviromnent*>(obj);
+                Ref(env->parent_);
+                size_t size = 0;
+                env->table.ForEachEntry([&size](uint32_t, Object*) { ++size; });
+                Varint(size);
+                env->table.ForEachEntry([this](uint32_t id, Object* value) {
+                    Ref(heap_.Symbols()->At(id));
+                    Ref(value);
+                });
+                break;
+            }
+            default:
+                throw RuntimeError("");
+        }
+    }
+
+    static std::string_view BuiltinName(BuildFunction::FuncPtr func) {
+        for (const auto& [name, builtin] : kBuiltins) {
+            if (builtin == func) {
+                return name;
+            }
+        }
+        throw RuntimeError("");
     }
-    if (Symbol* s = As<Symbol>(result)) {
-        return s->GetName();
+
+    void Ref(Object* obj) {
+        if (!obj || IsBooleanImmediate(obj)) {
+            Varint(reinterpret_cast<uintptr_t>(obj));
+        } else if (IsFixnum(obj)) {
+            Varint(ZigZag(FixnumValue(obj)) << 1 | 1);
+        } else {
+            Varint((index_[obj] + 1) << 2);
+        }
     }
-    if (Cell* c = As<Cell>(result)) {
-        return SerializeList(c);
+
+    void Varint(uint64_t value) {
+        while (value >= 0x80) {
+            out_.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<char>(value));
     }
-    throw RuntimeError("");
-}
-struct CurrentHeapGuard {
-    CurrentHeapGuard(Heap* heap) {
-        SetCurrentHeap(heap);
+
+    void String(std::string_view str) {
+        Varint(str.size());
+        out_.append(str);
     }
 
-    ~CurrentHeapGuard() {
-        SetCurrentHeap(nullptr);
+    Heap& heap_;
+    std::unordered_map<Object*, uint64_t> index_;
+    std::vector<Symbol*> symbols_;
+    std::vector<Object*> objects_;
+    std::string out_;
+};
+
+// Loads an image in two passes. The first allocates every object with placeholders, the encoded
+// references, in place of its pointers; the second links them up with UpdateObject. Make never
+// collects, so nothing looks at a placeholder in between.
+class ImageReader {
+public:
+    ImageReader(std::string_view data, Heap& heap, Enviromnent& global)
+        : pos_(data.data()), end_(data.data() + data.size()), heap_(heap) {
+        if (data.size() < sizeof(kImageMagic) ||
+            !std::equal(kImageMagic, kImageMagic + sizeof(kImageMagic), pos_)) {
+            throw ImageError("not a heap image");
+        }
+        pos_ += sizeof(kImageMagic);
+        if (Varint() != kImageVersion) {
+            throw ImageError("unsupported heap image version");
+        }
+        uint64_t root = Varint();
+        count_ = Varint();
+        // Every record takes at least a byte.
+        if (root >= count_ || count_ > static_cast<uint64_t>(end_ - pos_)) {
+            Corrupt();
+        }
+        objects_.reserve(count_);
+        for (uint64_t i = 0; i < count_; ++i) {
+            objects_.push_back(ReadObject(i == root ? &global : nullptr));
+        }
+        if (pos_ != end_) {
+            Corrupt();
+        }
+
+        for (Object* obj : objects_) {
+            if (obj->GetType() == ObjectType::LAMBDA_FUNCTION) {
+                CheckScope(static_cast<LambdaFunction*>(obj)->GetEnv());
+            } else if (obj != &global && obj->GetType() == ObjectType::ENVIRONMENT) {
+                CheckScope(static_cast<Enviromnent*>(obj)->parent_);
+            }
+        }
+        if (global.parent_) {
+            Corrupt();
+        }
+        for (Object* obj : objects_) {
+            UpdateObject(obj, [this](Object* ref) { return Resolve(ref); });
+        }
+        CheckChains(global);
+
+        // Builtins added since the image was saved.
+        for (const auto& [name, func] : kBuiltins) {
+            Symbol* symbol = heap_.Intern(name);
+            if (!global.table.Find(symbol->GetId())) {
+                global.table.Set(symbol->GetId(), heap_.Make<BuildFunction>(func));
+            }
+        }
+    }
+
+private:
+    // The global environment is already there, so its record only fills it in.
+    Object* ReadObject(Enviromnent* global) {
+        auto type = static_cast<ObjectType>(Byte());
+        if (global && type != ObjectType::ENVIRONMENT) {
+            Corrupt();
+        }
+        switch (type) {
+            case ObjectType::SYMBOL:
+                return heap_.Intern(String());
+            case ObjectType::NUMBER:
+                return heap_.Make<Number>(UnZigZag(Varint()));
+            case ObjectType::CELL: {
+                Object* first = Placeholder();
+                return heap_.Make<Cell>(first, Placeholder());
+            }
+            case ObjectType::BUILD_FUNCTION: {
+                std::string_view name = String();
+                for (const auto& [builtin, func] : kBuiltins) {
+                    if (name == builtin) {
+                        return heap_.Make<BuildFunction>(func);
+                    }
+                }
+                throw ImageError("unknown builtin " + std::string(name));
+            }
+            case ObjectType::LAMBDA_FUNCTION: {
+                auto* env = static_cast<Enviromnent*>(Placeholder());
+                std::vector<Symbol*> params(Size());
+                for (Symbol*& param : params) {
+                    param = ReadSymbol();
+                }
+                std::vector<Object*> body(Size());
+                for (Object*& expr : body) {
+                    expr = Placeholder();
+                }
+                return heap_.Make<LambdaFunction>(env, std::move(params), std::move(body));
+            }
+            case ObjectType::ENVIRONMENT: {
+                Enviromnent* env = global;
+                if (!env) {
+                    env = heap_.Make<Enviromnent>(&heap_);
+                    env->on_heap_ = true;
+                }
+                env->parent_ = static_cast<Enviromnent*>(Placeholder());
+                for (uint64_t size = Size(); size > 0; --size) {
+                    Symbol* name = ReadSymbol();
+                    env->table.Set(name->GetId(), Placeholder());
+                }
+                return env;
+            }
+            default:
+                Corrupt();
+        }
+    }
+
+    // Symbols come first, so a name always refers to a record read already.
+    Symbol* ReadSymbol() {
+        uint64_t ref = Varint();
+        uint64_t index = (ref >> 2) - 1;
+        if ((ref & 3) || ref == 0 || index >= objects_.size() ||
+            objects_[index]->GetType() != ObjectType::SYMBOL) {
+            Corrupt();
+        }
+        return static_cast<Symbol*>(objects_[index]);
+    }
+
+    Object* Placeholder() {
+        uint64_t ref = Varint();
+        if (ref & 1) {
+            return MakeFixnum(UnZigZag(ref >> 1));
+        }
+        if ((ref & 3) == 2) {
+            if (ref != 2 && ref != 6) {
+                Corrupt();
+            }
+            return MakeBoolean(ref == 6);
+        }
+        if (ref != 0 && (ref >> 2) - 1 >= count_) {
+            Corrupt();
+        }
+        return reinterpret_cast<Object*>(static_cast<uintptr_t>(ref));
+    }
+
+    Object* Resolve(Object* ref) {
+        if (!ref || IsImmediate(ref)) {
+            return ref;
+        }
+        return objects_[(reinterpret_cast<uintptr_t>(ref) >> 2) - 1];
+    }
+
+    // Every parent chain must end at the global environment rather than loop, or lookups of
+    // unbound names and collections would never end. Scopes already known to get there are
+    // remembered, so that each is walked once.
+    void CheckChains(Enviromnent& global) {
+        std::unordered_set<Enviromnent*> grounded{&global};
+        std::vector<Enviromnent*> chain;
+        for (Object* obj : objects_) {
+            if (obj->GetType() != ObjectType::ENVIRONMENT) {
+                continue;
+            }
+            chain.clear();
+            auto* scope = static_cast<Enviromnent*>(obj);
+            for (; !grounded.count(scope); scope = scope->parent_) {
+                if (!scope || chain.size() == count_) {
+                    Corrupt();
+                }
+                chain.push_back(scope);
+            }
+            grounded.insert(chain.begin(), chain.end());
+        }
     }
+
+    // A closure must have a scope, and every scope but the global one a parent scope.
+    void CheckScope(Object* ref) {
+        if (TypeOf(Resolve(ref)) != ObjectType::ENVIRONMENT) {
+            Corrupt();
+        }
+    }
+
+    uint8_t Byte() {
+        if (pos_ == end_) {
+            Corrupt();
+        }
+        return static_cast<uint8_t>(*pos_++);
+    }
+
+    uint64_t Varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = Byte();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        Corrupt();
+    }
+
+    // A count of items that take at least a byte each.
+    size_t Size() {
+        uint64_t size = Varint();
+        if (size > static_cast<uint64_t>(end_ - pos_)) {
+            Corrupt();
+        }
+        return size;
+    }
+
+    std::string_view String() {
+        size_t size = Size();
+        std::string_view str(pos_, size);
+        pos_ += size;
+        return str;
+    }
+
+    [[noreturn]] static void Corrupt() {
+        throw ImageError("corrupt heap image");
+    }
+
+    const char* pos_;
+    const char* end_;
+    Heap& heap_;
+    uint64_t count_ = 0;
+    std::vector<Object*> objects_;
 };
+
+}  // namespace
+
 std::string Interpreter::Run(const std::string& str) {
-    std::stringstream ss(str);
-    Tokenizer tokenizer(&ss);
-    CurrentHeapGuard heap_guard(&heap_);
+    Tokenizer tokenizer{std::string_view{str}};
     HeapGuard guard(heap_, env_);
-    Object* expr = Read(&tokenizer);
+    Object* expr = Read(&tokenizer, heap_);
+    Heap::LocalRoots root(heap_, expr);
     Object* result = Eval(expr, env_);
     std::string s = Serialize(result);
     return s;
 }
+
+std::string Interpreter::RunProgram(std::string_view source) {
+    HeapGuard guard(heap_, env_);
+    std::vector<Object*> forms = ReadParallel(source, heap_, reader_threads_);
+    Heap::LocalRoots roots(heap_, forms.data(), forms.size());
+    Object* result = nullptr;
+    for (size_t i = 0; i < forms.size(); ++i) {
+        // Forms not yet evaluated are only reachable from the roots registered above.
+        heap_.Safepoint(env_);
+        result = Eval(forms[i], env_);
+        forms[i] = nullptr;
+    }
+    return Serialize(result);
+}
+
+std::string Interpreter::RunFile(const std::string& path) {
+    MappedFile file(path);
+    return RunProgram(file.View());
+}
+
+Interpreter::Prepared Interpreter::Prepare(std::string_view source) {
+    Tokenizer tokenizer{source};
+    Object* expr = Read(&tokenizer, heap_);
+    if (!tokenizer.IsEnd()) {
+        throw SyntaxError("");
+    }
+    return Prepared(&heap_, heap_.Pin(expr));
+}
+
+Object* Interpreter::Execute(const Prepared& expr, const Bindings& bindings) {
+    Enviromnent local_env(&heap_, &env_);
+    Heap::FrameRoot frame_root(heap_, &local_env);
+    for (const auto& [name, value] : bindings) {
+        local_env.Set(name, value);
+    }
+    heap_.Safepoint(local_env);
+    return Eval(heap_.Pinned(expr.pin_), local_env);
+}
+
+Interpreter::Interpreter(const std::string& image_path) : heap_(), env_(&heap_) {
+    MappedFile file(image_path);
+    ImageReader(file.View(), heap_, env_);
+}
+
+void Interpreter::SaveImage(const std::string& path) {
+    ImageWriter image(heap_, env_);
+    // Written next to path and renamed over it, so that a failed write leaves any previous image
+    // intact.
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(image.Data().data(), static_cast<std::streamsize>(image.Data().size()));
+    out.close();
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot write heap image " + path);
+    }
+}
+
+Object* Interpreter::MakeNumber(int64_t value) {
+    return ::MakeNumber(heap_, value);
+}
+
+Object* Interpreter::MakeBoolean(bool value) {
+    return ::MakeBoolean(value);
+}
@@ -1,15 +1,139 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include <object.h>
 Enviromnent MakeGlobalEnv(Heap* heap);
 class Interpreter {
 public:
     Interpreter() :heap_(),  env_(MakeGlobalEnv(&heap_)) {
     }
+
+    // Restores the global environment saved by SaveImage, with every definition in it, instead of
+    // building a fresh one; builtins newer than the image are bound as usual. Throws ImageError if
+    // the file is not an image this build can load.
+    explicit Interpreter(const std::string& image_path);
+
+    ~Interpreter() {
+        heap_.CancelMarking();
+    }
     std::string Run(const std::string&);
 
+    // Evaluates every top-level form in order and returns the serialized value of the last one.
+    // Unlike Run, garbage is collected when the allocation volume calls for it rather than after
+    // each form.
+    std::string RunProgram(std::string_view source);
+    std::string RunFile(const std::string& path);
+
+    // Writes the global environment and everything reachable from it (definitions, closures and
+    // the scopes they captured, quoted data) to an image file, which loads far faster than the
+    // source that built it runs. Prepared forms are not saved. The file is replaced only once the
+    // image is written in full; on failure, std::runtime_error is thrown and it is left as it was.
+    void SaveImage(const std::string& path);
+
+    // A form read once by Prepare() and kept alive until the Prepared is destroyed, so that
+    // Execute() can evaluate it again and again without tokenizing, parsing or serializing. It must
+    // not outlive the interpreter that prepared it.
+    class Prepared {
+    public:
+        Prepared() = default;
+        Prepared(Prepared&& other) noexcept
+            : heap_(std::exchange(other.heap_, nullptr)), pin_(other.pin_) {
+        }
+        Prepared& operator=(Prepared&& other) noexcept {
+            if (this != &other) {
+                Release();
+                heap_ = std::exchange(other.heap_, nullptr);
+                pin_ = other.pin_;
+            }
+            return *this;
+        }
+        ~Prepared() {
+            Release();
+        }
+
+    private:
+        friend class Interpreter;
+        Prepared(Heap* heap, size_t pin) : heap_(heap), pin_(pin) {
+        }
+
+        void Release() {
+            if (heap_) {
+                heap_->Unpin(pin_);
+                heap_ = nullptr;
+            }
+        }
+
+        Heap* heap_ = nullptr;
+        // Where the heap keeps the form pinned, so that it is found even when compaction moves it.
+        size_t pin_ = static_cast<size_t>(-1);
+    };
+    using Bindings = std::vector<std::pair<std::string, Object*>>;
+
+    // Source must hold exactly one datum.
+    Prepared Prepare(std::string_view source);
+
+    // Evaluates expr in a fresh scope on top of the global environment, with bindings defined in
+    // it. The result is a heap object that stays valid until the next Run, RunProgram or Execute,
+    // any of which may collect it. Garbage is collected by allocation volume, as in RunProgram.
+    Object* Execute(const Prepared& expr, const Bindings& bindings = {});
+
+    // Values for Execute() bindings. Like results, they stay valid until the next Run, RunProgram
+    // or Execute.
+    Object* MakeNumber(int64_t value);
+    Object* MakeBoolean(bool value);
+
+    // Past either limit, evaluation throws OutOfMemoryError; see Heap::SetMemoryLimit. The
+    // interpreter stays usable afterwards.
+    void SetMemoryLimit(size_t bytes) {
+        heap_.SetMemoryLimit(bytes);
+    }
+
+    void SetObjectLimit(size_t objects) {
+        heap_.SetObjectLimit(objects);
+    }
+
+    // Whether full collections mark on a background thread; see Heap::SetConcurrentMarking.
+    void SetConcurrentMarking(bool enable) {
+        heap_.SetConcurrentMarking(enable);
+    }
+
+    // The length of the marking slices of full collections, or zero to mark them in one go; see
+    // Heap::SetIncrementalMarking.
+    void SetIncrementalMarking(std::chrono::nanoseconds slice) {
+        heap_.SetIncrementalMarking(slice);
+    }
+
+    // Whether full collections between statements compact; see Heap::SetCompaction.
+    void SetCompaction(bool enable) {
+        heap_.SetCompaction(enable);
+    }
+
+    // Threads that full collections mark and sweep with; see Heap::SetCollectorThreads.
+    void SetCollectorThreads(size_t threads) {
+        heap_.SetCollectorThreads(threads);
+    }
+
+    // Threads that RunProgram reads with; zero, the default, is one per hardware thread. See
+    // ReadParallel.
+    void SetReaderThreads(size_t threads) {
+        reader_threads_ = threads;
+    }
+
+    // The lengths of the pauses of all collections so far.
+    const PauseHistogram& GcPauses() const {
+        return heap_.Pauses();
+    }
+
+    // Object counts by type and collection costs; see Heap::Stats.
+    HeapStats GcStats() {
+        return heap_.Stats();
+    }
+
 private:
     Heap heap_;
     Enviromnent env_;
+    size_t reader_threads_ = 0;
 };
@@ -12,6 +12,10 @@ public:
         REQUIRE(interpreter_.Run(expression) == result);
     }
 
+    void ExpectProgramEq(std::string program, const std::string& result) {
+        REQUIRE(interpreter_.RunProgram(program) == result);
+    }
+
     void ExpectNoError(std::string expression) {
         REQUIRE_NOTHROW(interpreter_.Run(expression));
     }
@@ -28,7 +32,7 @@ public:
         REQUIRE_THROWS_AS(interpreter_.Run(expression), NameError);
     }
 
-private:
+protected:
     Interpreter interpreter_;
 };
 
@@ -1,5 +1,10 @@
 #include "scheme_test.h"
 
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
 TEST_CASE_METHOD(SchemeTest, "Quote") {
     ExpectEq("(quote (1 2))", "(1 2)");
     ExpectEq("'(1 2)", "(1 2)");
@@ -11,3 +16,149 @@ TEST_CASE_METHOD(SchemeTest, "Be careful") {
     ExpectRuntimeError("('() ())");
     ExpectEq("'(())", "(())");
 }
+
+TEST_CASE_METHOD(SchemeTest, "Program") {
+    ExpectProgramEq("", "()");
+    ExpectProgramEq("(define x 1) (define (inc y) (+ y 1)) (set! x (inc x)) x", "2");
+    ExpectEq("(inc x)", "3");
+
+    ExpectProgramEq(R"EOF(
+        (define (range a b) (if (= a b) '() (cons a (range (+ a 1) b))))
+        (define xs (range 0 5))
+        (list-tail xs 3)
+    )EOF",
+                    "(3 4)");
+}
+
+TEST_CASE_METHOD(SchemeTest, "ProgramErrors") {
+    REQUIRE_THROWS_AS(interpreter_.RunProgram("(define x 1) (1 . 2 3)"), SyntaxError);
+    ExpectNameError("x");
+
+    REQUIRE_THROWS_AS(interpreter_.RunProgram("(define y 1) (undefined) (define z 2)"), NameError);
+    ExpectEq("y", "1");
+    ExpectNameError("z");
+}
+
+TEST_CASE_METHOD(SchemeTest, "LongProgramCollectsAsItGoes") {
+    // Every form leaves garbage behind, and the pending forms must survive collections.
+    std::string program = "(define acc '())\n";
+    for (int i = 0; i < 5000; ++i) {
+        program += "(set! acc (cons " + std::to_string(i) + " (list-tail acc 0)))\n";
+        program += "(define tmp-" + std::to_string(i % 7) + " (list 1 2 3 4 5 6 7 8))\n";
+    }
+    program += "(list-ref acc 0)";
+    ExpectProgramEq(program, "4999");
+    ExpectEq("(list-ref acc 4999)", "0");
+}
+
+TEST_CASE_METHOD(SchemeTest, "ProgramFromFile") {
+    std::string path = "scheme_program_test.scm";
+    {
+        std::ofstream out{path};
+        out << "(define (sq x) (* x x))\n(sq 12)\n";
+    }
+    std::string result = interpreter_.RunFile(path);
+    std::remove(path.c_str());
+    REQUIRE(result == "144");
+    ExpectEq("(sq 3)", "9");
+}
+
+TEST_CASE_METHOD(SchemeTest, "ProgramThroughput", "[.][bench]") {
+    std::string program;
+    std::vector<std::string> lines;
+    for (int i = 0; i < 5000; ++i) {
+        lines.push_back("(define v" + std::to_string(i) + " (list " + std::to_string(i) + " 2 3))");
+        program += lines.back() + "\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& line : lines) {
+        interpreter_.Run(line);
+    }
+    std::chrono::duration<double> per_statement = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    interpreter_.RunProgram(program);
+    std::chrono::duration<double> batch = std::chrono::steady_clock::now() - start;
+
+    std::cerr << "Run per line: " << per_statement.count() << "s, RunProgram: " << batch.count()
+              << "s\n";
+}
+
+TEST_CASE_METHOD(SchemeTest, "PreparedExpressions") {
+    ExpectNoError("(define (clamp x lo hi) (max lo (min x hi)))");
+    auto clamp = interpreter_.Prepare("(clamp (+ x offset) 0 100)");
+    auto pair = interpreter_.Prepare("'(x . y)");
+
+    for (int x : {-50, 7, 99, 250}) {
+        Object* result = interpreter_.Execute(
+            clamp, {{"x", interpreter_.MakeNumber(x)}, {"offset", interpreter_.MakeNumber(3)}});
+        REQUIRE(As<Number>(result)->GetValue() == std::max(0, std::min(x + 3, 100)));
+
+        // Prepared forms survive the collections done by Run.
+        ExpectEq("(+ 1 2)", "3");
+    }
+
+    Object* quoted = interpreter_.Execute(pair);
+    REQUIRE(As<Symbol>(As<Cell>(quoted)->GetFirst())->GetName() == "x");
+
+    // Bindings shadow globals only for the duration of Execute.
+    ExpectNoError("(define x 1)");
+    auto get_x = interpreter_.Prepare("x");
+    Object* shadowed = interpreter_.Execute(get_x, {{"x", interpreter_.MakeNumber(5)}});
+    REQUIRE(As<Number>(shadowed)->GetValue() == 5);
+    REQUIRE(As<Number>(interpreter_.Execute(get_x))->GetValue() == 1);
+
+    REQUIRE(As<Boolean>(interpreter_.Execute(interpreter_.Prepare("(not flag)"),
+                                             {{"flag", interpreter_.MakeBoolean(false)}}))
+                ->GetValue());
+}
+
+TEST_CASE_METHOD(SchemeTest, "PreparedExpressionErrors") {
+    REQUIRE_THROWS_AS(interpreter_.Prepare("(1 . 2 3)"), SyntaxError);
+    REQUIRE_THROWS_AS(interpreter_.Prepare("1 2"), SyntaxError);
+    REQUIRE_THROWS_AS(interpreter_.Prepare(""), SyntaxError);
+
+    auto expr = interpreter_.Prepare("(+ x 1)");
+    REQUIRE_THROWS_AS(interpreter_.Execute(expr), NameError);
+    REQUIRE_THROWS_AS(interpreter_.Execute(expr, {{"x", interpreter_.MakeBoolean(true)}}),
+                      RuntimeError);
+}
+
+TEST_CASE_METHOD(SchemeTest, "PreparedExpressionsAreReleased") {
+    std::string list = "'(";
+    for (int i = 0; i < 10'000; ++i) {
+        list += "x ";
+    }
+    list += ")";
+
+    // Twenty forms of 10k cells each fit under the limit only if each is collected once dropped.
+    interpreter_.SetObjectLimit(50'000);
+    for (int i = 0; i < 20; ++i) {
+        auto expr = interpreter_.Prepare(list);
+        Interpreter::Prepared moved = std::move(expr);
+        REQUIRE(Is<Cell>(interpreter_.Execute(moved)));
+        ExpectEq("(+ 1 2)", "3");
+    }
+}
+
+TEST_CASE_METHOD(SchemeTest, "PreparedThroughput", "[.][bench]") {
+    constexpr int kIterations = 100'000;
+    ExpectNoError("(define (score a b) (if (< a b) (* 2 (- b a)) (+ a b)))");
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        interpreter_.Run("(score " + std::to_string(i % 17) + " 9)");
+    }
+    std::chrono::duration<double> run = std::chrono::steady_clock::now() - start;
+
+    auto expr = interpreter_.Prepare("(score a 9)");
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        interpreter_.Execute(expr, {{"a", interpreter_.MakeNumber(i % 17)}});
+    }
+    std::chrono::duration<double> execute = std::chrono::steady_clock::now() - start;
+
+    std::cerr << "Run: " << run.count() << "s, Prepare/Execute: " << execute.count() << "s for "
+              << kIterations << " evaluations\n";
+}
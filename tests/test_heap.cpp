@@ -0,0 +1,638 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <allocations_checker.h>
+#include <arena.h>
+#include <parser.h>
+#include <scheme.h>
+
+TEST_CASE("Arena reuses cells and releases empty slabs") {
+    Arena arena;
+    std::vector<void*> cells;
+    for (int i = 0; i < 10'000; ++i) {
+        cells.push_back(arena.Allocate(32));
+    }
+    size_t slabs = arena.SlabCount();
+    REQUIRE(slabs > 1);
+    for (void* cell : cells) {
+        REQUIRE(reinterpret_cast<uintptr_t>(cell) % Arena::kGranule == 0);
+    }
+
+    // Free every other cell; allocating as many again must not take new slabs.
+    size_t index = 0;
+    size_t live = arena.Sweep([&index](void*) { return index++ % 2 == 0; });
+    REQUIRE(live == cells.size() / 2);
+    for (int i = 0; i < 5'000; ++i) {
+        arena.Allocate(32);
+    }
+    REQUIRE(arena.SlabCount() == slabs);
+
+    // Empty slabs are kept for one more cycle of the same size, then released.
+    REQUIRE(arena.Sweep([](void*) { return true; }) == 0);
+    REQUIRE(arena.SlabCount() == slabs);
+    REQUIRE(arena.Sweep([](void*) { return true; }) == 0);
+    REQUIRE(arena.SlabCount() == 0);
+
+    // Size classes do not share slabs.
+    arena.Allocate(32);
+    arena.Allocate(100);
+    REQUIRE(arena.SlabCount() == 2);
+}
+
+TEST_CASE("Building lists does not call operator new per cell") {
+    Interpreter interpreter;
+    std::string program = "(define xs (list";
+    for (int i = 0; i < 10'000; ++i) {
+        program += " " + std::to_string(i);
+    }
+    program += "))";
+
+    alloc_checker::ResetCounters();
+    interpreter.Run(program);
+    REQUIRE(alloc_checker::AllocCount() < 100);
+    REQUIRE(interpreter.Run("(list-ref xs 9999)") == "9999");
+}
+
+TEST_CASE("Heap allocation throughput", "[.][bench]") {
+    constexpr int kRounds = 100;
+    constexpr int kLength = 100'000;
+    Heap heap;
+    Enviromnent env(&heap);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+        Object* list = nullptr;
+        for (int i = 0; i < kLength; ++i) {
+            list = heap.Make<Cell>(heap.Make<Number>(i), list);
+        }
+        heap.Collect(env);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cerr << "Heap::Make: " << 2.0 * kRounds * kLength / elapsed.count() / 1e6
+              << "M objects/s including collection\n";
+}
+
+namespace {
+
+std::string LongList(int length, bool nested) {
+    std::string program = "(list";
+    for (int i = 0; i < length; ++i) {
+        program += nested ? " (list " + std::to_string(i) + ")" : " " + std::to_string(i);
+    }
+    return program + ")";
+}
+
+}  // namespace
+
+TEST_CASE("Very long lists are collected without recursion") {
+    Interpreter interpreter;
+    REQUIRE(interpreter.Run("(define xs " + LongList(1'000'000, false) + ")") == "#t");
+    REQUIRE(interpreter.Run("(list-tail xs 999999)") == "(999999)");
+    REQUIRE(interpreter.Run("(define xs 0)") == "#t");
+
+    // Every element of a list of lists waits on the mark stack, which overflows here.
+    REQUIRE(interpreter.Run("(define ys " + LongList(200'000, true) + ")") == "#t");
+    REQUIRE(interpreter.Run("(list-ref ys 0)") == "(0)");
+    REQUIRE(interpreter.Run("(list-ref ys 199999)") == "(199999)");
+}
+
+namespace {
+
+Object* Evaluate(Heap& heap, Enviromnent& env, std::string_view source) {
+    Tokenizer tokenizer{source};
+    Object* expr = Read(&tokenizer, heap);
+    Heap::LocalRoots root(heap, expr);
+    return Eval(expr, env);
+}
+
+}  // namespace
+
+TEST_CASE("Long computations collect garbage as they run") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    Evaluate(heap, env, "(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n n n))))");
+    Evaluate(heap, env, "(define (churn-step n garbage) (churn n))");
+    Evaluate(heap, env, "(define (outer m) (if (= m 0) 0 (+ (churn 500) (outer (- m 1)))))");
+
+    // 2M garbage cells, 64 MiB if nothing were collected before the call returns.
+    REQUIRE(As<Number>(Evaluate(heap, env, "(outer 1000)"))->GetValue() == 0);
+    REQUIRE(heap.Footprint() < (size_t{16} << 20));
+}
+
+TEST_CASE("Temporaries survive collections at safepoints") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    Evaluate(heap, env, "(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    Evaluate(heap, env, "(define (churn-step n garbage) (churn n))");
+    Evaluate(heap, env, "(define (pass ignored x) x)");
+    // The operands of cons and list, the frames of build and the closure returned by make-cell
+    // are only held by the evaluator while churn collects.
+    Evaluate(heap, env, "(define (make-cell n) (lambda () (list n (churn 50) n)))");
+    Evaluate(heap, env, R"(
+        (define (build n acc)
+            (if (= n 0)
+                acc
+                (build (- n 1) (cons ((make-cell n)) (pass (churn 200) acc)))))
+    )");
+
+    REQUIRE(As<Boolean>(Evaluate(heap, env, "(define xs (build 2000 '()))"))->GetValue());
+
+    // Reuse every cell a premature collection could have freed, then check the whole list.
+    Evaluate(heap, env, "(define (spin m) (if (= m 0) 0 (+ (churn 500) (spin (- m 1)))))");
+    Evaluate(heap, env, "(spin 400)");
+    Object* cur = Evaluate(heap, env, "xs");
+    for (int i = 1; i <= 2000; ++i) {
+        REQUIRE(Is<Cell>(cur));
+        Object* item = As<Cell>(cur)->GetFirst();
+        REQUIRE(Is<Cell>(item));
+        REQUIRE(As<Number>(As<Cell>(item)->GetFirst())->GetValue() == i);
+        cur = As<Cell>(cur)->GetSecond();
+    }
+    REQUIRE(cur == nullptr);
+}
+
+TEST_CASE("Minor collections keep young objects stored into old ones") {
+    // Every Run ends with a minor collection, which promotes what the definitions hold.
+    Interpreter interpreter;
+    interpreter.Run("(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    interpreter.Run("(define (churn-step n garbage) (churn n))");
+    interpreter.Run("(define pair (cons 0 0))");
+    interpreter.Run("(define (make-box) (define v 0) (lambda (x) (if x (set! v x) v)))");
+    interpreter.Run("(define box (make-box))");
+
+    for (int i = 0; i < 50; ++i) {
+        std::string n = std::to_string(i);
+        // Only the old pair and the old frame of box hold the new lists.
+        interpreter.Run("(set-car! pair (list " + n + " " + n + "))");
+        interpreter.Run("(box (list " + n + "))");
+        interpreter.Run("(churn 300)");
+        REQUIRE(interpreter.Run("pair") == "((" + n + " " + n + ") . 0)");
+        REQUIRE(interpreter.Run("(box #f)") == "(" + n + ")");
+    }
+}
+
+TEST_CASE("Collection cost with a large old generation", "[.][bench]") {
+    Interpreter interpreter;
+    interpreter.Run("(define xs " + LongList(1'000'000, false) + ")");
+    interpreter.Run("(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    interpreter.Run("(define (churn-step n garbage) (churn n))");
+
+    // Every Run ends with a collection.
+    constexpr int kRuns = 200;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRuns; ++i) {
+        interpreter.Run("(churn 100)");
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Run with 1M old cells: " << elapsed.count() / kRuns * 1e6 << " us\n";
+}
+
+TEST_CASE("Concurrent marking keeps what the program moves while it runs") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    heap.SetConcurrentMarking(true);
+    Evaluate(heap, env, "(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    Evaluate(heap, env, "(define (churn-step n garbage) (churn n))");
+    Evaluate(heap, env, "(define (make-box v) (lambda (x) (if x (set! v x) v)))");
+
+    for (int round = 0; round < 20; ++round) {
+        std::string n = std::to_string(round);
+        // The marker traces the cdr of holder, to, right away, and reaches from, at the end of a
+        // long list in its car, much later.
+        Cell* from = heap.Make<Cell>(heap.Make<Cell>(MakeFixnum(round), nullptr), nullptr);
+        Cell* to = heap.Make<Cell>(nullptr, nullptr);
+        Object* chain = from;
+        for (int i = 0; i < 100'000; ++i) {
+            chain = heap.Make<Cell>(MakeFixnum(i), chain);
+        }
+        env.Set("holder", heap.Make<Cell>(chain, to));
+        Evaluate(heap, env, "(define from-box (make-box (list " + n + ")))");
+        Evaluate(heap, env, "(define to-box (make-box 0))");
+        // Promote long lists until the old generation has doubled and marking starts.
+        while (!heap.IsMarking()) {
+            Evaluate(heap, env, "(define xs " + LongList(100'000, false) + ")");
+            heap.CollectYoung(env);
+        }
+
+        // Move each list to an object the marker has probably traced already.
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        to->SetFirst(from->GetFirst());
+        from->SetFirst(nullptr);
+        Evaluate(heap, env, "(to-box (from-box #f))");
+        Evaluate(heap, env, "(from-box 0)");
+        while (heap.IsMarking()) {
+            std::this_thread::yield();
+            heap.CollectYoung(env);
+        }
+
+        Evaluate(heap, env, "(churn 1000)");
+        REQUIRE(Is<Cell>(to->GetFirst()));
+        REQUIRE(As<Number>(As<Cell>(to->GetFirst())->GetFirst())->GetValue() == round);
+        Object* moved = Evaluate(heap, env, "(to-box #f)");
+        REQUIRE(Is<Cell>(moved));
+        REQUIRE(As<Number>(As<Cell>(moved)->GetFirst())->GetValue() == round);
+    }
+}
+
+namespace {
+
+void PrintPauses(const char* name, const PauseHistogram& pauses) {
+    std::cerr << name << ": " << pauses.Total() << " pauses, longest "
+              << pauses.Max().count() / 1000 << " us\n";
+    for (size_t i = 0; i < PauseHistogram::kBuckets; ++i) {
+        if (pauses.Count(i)) {
+            std::cerr << "  < " << (uint64_t{1} << i) << " us: " << pauses.Count(i) << "\n";
+        }
+    }
+}
+
+}  // namespace
+
+TEST_CASE("Pause times with and without concurrent marking", "[.][bench]") {
+    for (bool concurrent : {false, true}) {
+        Interpreter interpreter;
+        interpreter.SetConcurrentMarking(concurrent);
+        interpreter.Run("(define xs " + LongList(1'000'000, false) + ")");
+        interpreter.Run("(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+        interpreter.Run("(define (churn-step n garbage) (churn n))");
+        // Each request leaves a little garbage and promotes a little more, so the old generation
+        // keeps growing and is collected in full now and then.
+        std::string keep = "(define kept " + LongList(1'000, false) + ")";
+        for (int i = 0; i < 3'000; ++i) {
+            interpreter.Run("(churn 100)");
+            interpreter.Run(keep);
+        }
+        PrintPauses(concurrent ? "concurrent marking" : "stop the world", interpreter.GcPauses());
+    }
+}
+
+TEST_CASE("Incremental marking keeps what the program moves between slices") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    heap.SetIncrementalMarking(std::chrono::microseconds(20));
+    Evaluate(heap, env, "(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    Evaluate(heap, env, "(define (churn-step n garbage) (churn n))");
+
+    for (int round = 0; round < 5; ++round) {
+        // As in the concurrent test, to is traced right away and from much later.
+        Cell* from = heap.Make<Cell>(heap.Make<Cell>(MakeFixnum(round), nullptr), nullptr);
+        Cell* to = heap.Make<Cell>(nullptr, nullptr);
+        Object* chain = from;
+        for (int i = 0; i < 100'000; ++i) {
+            chain = heap.Make<Cell>(MakeFixnum(i), chain);
+        }
+        env.Set("holder", heap.Make<Cell>(chain, to));
+        while (!heap.IsMarking()) {
+            Evaluate(heap, env, "(define xs " + LongList(100'000, false) + ")");
+            heap.CollectYoung(env);
+        }
+
+        // One slice is far too short to reach from.
+        heap.CollectYoung(env);
+        REQUIRE(heap.IsMarking());
+        to->SetFirst(from->GetFirst());
+        from->SetFirst(nullptr);
+        while (heap.IsMarking()) {
+            heap.CollectYoung(env);
+        }
+
+        // to is still young, and the sweep that Make does must not promote it behind the
+        // barrier's back.
+        to->SetSecond(heap.Make<Cell>(MakeFixnum(round), nullptr));
+        for (int i = 0; i < 50; ++i) {
+            Evaluate(heap, env, "(churn 2000)");
+        }
+        REQUIRE(As<Number>(As<Cell>(to->GetFirst())->GetFirst())->GetValue() == round);
+        REQUIRE(As<Number>(As<Cell>(to->GetSecond())->GetFirst())->GetValue() == round);
+    }
+}
+
+TEST_CASE("Pause times with incremental marking and lazy sweeping", "[.][bench]") {
+    for (int slice_us : {0, 1000, 250}) {
+        Interpreter interpreter;
+        interpreter.SetIncrementalMarking(std::chrono::microseconds(slice_us));
+        interpreter.Run("(define xs '())");
+        interpreter.Run("(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+        interpreter.Run("(define (churn-step n garbage) (churn n))");
+        // The old generation grows to about 1M cells by requests small enough that minor
+        // collections stay short, so the long pauses are those of full collections.
+        std::string keep = "(define kept " + LongList(1'000, false) + ")";
+        for (int i = 0; i < 3'000; ++i) {
+            interpreter.Run("(churn 100)");
+            interpreter.Run(keep);
+            if (i < 1'000) {
+                interpreter.Run("(define xs (cons kept xs))");
+            }
+        }
+        std::string name = slice_us ? std::to_string(slice_us) + " us slices" : "stop the world";
+        PrintPauses(name.c_str(), interpreter.GcPauses());
+    }
+}
+
+TEST_CASE("Parallel collections keep everything reachable") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    heap.SetCollectorThreads(4);
+    Evaluate(heap, env, "(define (churn n) (if (= n 0) 0 (churn-step (- n 1) (list n n))))");
+    Evaluate(heap, env, "(define (churn-step n garbage) (churn n))");
+    // Plenty of branches for the threads to share, and garbage in between.
+    Evaluate(heap, env, "(define xs " + LongList(50'000, true) + ")");
+    Evaluate(heap, env, "(define tmp " + LongList(50'000, true) + ")");
+    Evaluate(heap, env, "(define ys (list xs (list xs) (cons xs xs)))");
+    size_t footprint = heap.Footprint();
+
+    for (int round = 0; round < 5; ++round) {
+        Evaluate(heap, env, "(define tmp " + LongList(50'000, true) + ")");
+        heap.Collect(env);
+        Evaluate(heap, env, "(churn 5000)");
+        Object* cur = Evaluate(heap, env, "(list-ref ys 2)");
+        REQUIRE(As<Cell>(cur)->GetFirst() == As<Cell>(cur)->GetSecond());
+        cur = As<Cell>(cur)->GetFirst();
+        int intact = 0;
+        for (; Is<Cell>(cur); cur = As<Cell>(cur)->GetSecond()) {
+            Object* item = As<Cell>(cur)->GetFirst();
+            intact += Is<Cell>(item) && As<Number>(As<Cell>(item)->GetFirst())->GetValue() == intact;
+        }
+        REQUIRE(intact == 50'000);
+        REQUIRE(cur == nullptr);
+    }
+    // Each old tmp was freed.
+    REQUIRE(heap.Footprint() <= footprint);
+}
+
+TEST_CASE("Full collection time by thread count", "[.][bench]") {
+    for (size_t threads : {1, 2, 4, 8}) {
+        Heap heap;
+        Enviromnent env = MakeGlobalEnv(&heap);
+        heap.SetCollectorThreads(threads);
+        // About 3M cells in lists of lists, half of them garbage.
+        for (int i = 0; i < 8; ++i) {
+            std::string n = std::to_string(i);
+            Evaluate(heap, env, "(define xs" + n + " " + LongList(100'000, true) + ")");
+            Evaluate(heap, env, "(define tmp " + LongList(100'000, true) + ")");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        heap.Collect(env);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "Collect with " << threads << " threads: " << elapsed.count() * 1e3
+                  << " ms\n";
+    }
+}
+
+namespace {
+
+// How many cells of the list start directly follow the previous one in memory.
+int SequentialCells(Object* list) {
+    int count = 0;
+    for (Object* cur = list; Is<Cell>(cur); cur = As<Cell>(cur)->GetSecond()) {
+        Object* next = As<Cell>(cur)->GetSecond();
+        count += reinterpret_cast<char*>(next) - reinterpret_cast<char*>(cur) == sizeof(Cell);
+    }
+    return count;
+}
+
+}  // namespace
+
+TEST_CASE("Compaction lays lists out in order") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    // Every cell of xs is followed by garbage.
+    Evaluate(heap, env, R"(
+        (define (build n acc) (if (= n 0) acc (build-step n (cons n acc) (list n n n))))
+    )");
+    Evaluate(heap, env, "(define (build-step n acc garbage) (build (- n 1) acc))");
+    Evaluate(heap, env, "(define xs (build 1000 '()))");
+    Evaluate(heap, env, "(define (make-counter) (define n 0) (lambda () (set! n (+ n 1)) n))");
+    Evaluate(heap, env, "(define counter (make-counter))");
+    Evaluate(heap, env, "(counter)");
+    size_t pin = heap.Pin(Evaluate(heap, env, "(list-tail xs 998)"));
+    REQUIRE(SequentialCells(Evaluate(heap, env, "xs")) < 100);
+
+    heap.Compact(env);
+    REQUIRE(SequentialCells(Evaluate(heap, env, "xs")) >= 990);
+    REQUIRE(As<Number>(Evaluate(heap, env, "(list-ref xs 999)"))->GetValue() == 1000);
+    REQUIRE(As<Number>(Evaluate(heap, env, "(counter)"))->GetValue() == 2);
+    REQUIRE(heap.Pinned(pin) == Evaluate(heap, env, "(list-tail xs 998)"));
+
+    // Everything still works with the old slabs gone and the new ones reused.
+    Evaluate(heap, env, "(define ys (build 1000 '()))");
+    heap.Collect(env);
+    REQUIRE(As<Number>(Evaluate(heap, env, "(list-ref xs 500)"))->GetValue() == 501);
+    REQUIRE(As<Number>(Evaluate(heap, env, "(counter)"))->GetValue() == 3);
+}
+
+TEST_CASE("Prepared forms survive compaction") {
+    Interpreter interpreter;
+    interpreter.SetCompaction(true);
+    auto prepared = interpreter.Prepare("(cons x (list-ref xs 2))");
+    for (int i = 0; i < 10; ++i) {
+        // Each definition promotes a long list and drops the previous one, so full collections,
+        // which compact, happen every few rounds.
+        interpreter.Run("(define xs " + LongList(50'000, false) + ")");
+        Object* result = interpreter.Execute(prepared, {{"x", interpreter.MakeNumber(i)}});
+        REQUIRE(As<Number>(As<Cell>(result)->GetFirst())->GetValue() == i);
+        REQUIRE(As<Number>(As<Cell>(result)->GetSecond())->GetValue() == 2);
+    }
+}
+
+TEST_CASE("List traversal before and after compaction", "[.][bench]") {
+    constexpr int kLength = 1'000'000;
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    // Link cells in a random order, as after many set-cdr! calls.
+    std::vector<Cell*> cells;
+    for (int i = 0; i < kLength; ++i) {
+        cells.push_back(heap.Make<Cell>(MakeFixnum(i), nullptr));
+    }
+    std::vector<size_t> order(kLength);
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    uint64_t state = 42;
+    for (size_t i = order.size() - 1; i > 0; --i) {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        std::swap(order[i], order[(state >> 33) % (i + 1)]);
+    }
+    for (size_t i = 0; i + 1 < order.size(); ++i) {
+        cells[order[i]]->SetSecond(cells[order[i + 1]]);
+    }
+    env.Set("xs", cells[order[0]]);
+    cells.clear();
+
+    for (const char* phase : {"scattered", "compacted"}) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 10; ++i) {
+            Evaluate(heap, env, "(list-tail xs 999999)");
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "list-tail over " << phase << " cells: " << elapsed.count() / 10 * 1e3
+                  << " ms\n";
+        heap.Compact(env);
+    }
+}
+
+TEST_CASE("Heap statistics count objects by type and collections") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    HeapStats before = heap.Stats();
+    REQUIRE(before[ObjectType::BUILD_FUNCTION].live.objects > 0);
+    REQUIRE(before[ObjectType::CELL].total.objects == 0);
+
+    Evaluate(heap, env, "(define xs " + LongList(1'000, false) + ")");
+    Evaluate(heap, env, "(define big (* 1000000000 1000000000 5))");
+    Evaluate(heap, env, "(define (f) xs)");
+    heap.CollectYoung(env);
+    HeapStats stats = heap.Stats();
+    REQUIRE(stats[ObjectType::CELL].live.objects >= 1'000);
+    REQUIRE(stats[ObjectType::CELL].live.bytes ==
+            stats[ObjectType::CELL].live.objects * sizeof(Cell));
+    REQUIRE(stats[ObjectType::NUMBER].live.objects == 1);
+    REQUIRE(stats[ObjectType::LAMBDA_FUNCTION].live.objects == 1);
+    REQUIRE(stats[ObjectType::BOOLEAN].total.objects == 0);
+    REQUIRE(stats[ObjectType::SYMBOL].live.objects == heap.Symbols()->Size());
+    REQUIRE(stats.minor_collections == 1);
+    REQUIRE(stats.full_collections == 0);
+    REQUIRE(stats.pauses == 1);
+    REQUIRE(stats.allocation_rate > 0);
+
+    Evaluate(heap, env, "(define xs '())");
+    heap.Collect(env);
+    HeapStats after = heap.Stats();
+    REQUIRE(after[ObjectType::CELL].live.objects + 1'000 <= stats[ObjectType::CELL].live.objects);
+    REQUIRE(after[ObjectType::CELL].total.objects >= stats[ObjectType::CELL].total.objects);
+    REQUIRE(after.Total().objects >= after.Live().objects);
+    REQUIRE(after.full_collections == 1);
+    REQUIRE(after.mark_time > stats.mark_time);
+    REQUIRE(after.sweep_time > stats.sweep_time);
+
+    std::string json = after.ToJson();
+    REQUIRE(json.front() == '{');
+    REQUIRE(json.back() == '}');
+    REQUIRE(json.find("\"number\":{\"live\":{\"objects\":1,") != std::string::npos);
+    REQUIRE(json.find("\"full_collections\":1,") != std::string::npos);
+}
+
+TEST_CASE("Heap statistics count what parallel reading allocates") {
+    Heap heap;
+    // Large enough to be split among the threads.
+    std::string source;
+    for (int i = 0; i < 20'000; ++i) {
+        source += "(a b c d e f g h i j)\n";
+    }
+    std::vector<Object*> forms = ReadParallel(source, heap, 4);
+    HeapStats stats = heap.Stats();
+    REQUIRE(stats[ObjectType::CELL].live.objects == 200'000);
+    REQUIRE(stats[ObjectType::CELL].total.objects == 200'000);
+    REQUIRE(stats.Total().bytes >= stats.Live().bytes);
+    REQUIRE(stats.allocation_rate > 0);
+}
+
+TEST_CASE("What a program read in parallel allocates counts towards collections and limits") {
+    // Large enough to be split among the threads: 240k objects.
+    std::string source;
+    for (int i = 0; i < 20'000; ++i) {
+        source += "'(a b c d e f g h i j)\n";
+    }
+
+    Interpreter paced;
+    paced.SetReaderThreads(4);
+    paced.RunProgram(source);
+    // One collection at the first safepoint, and the one that ends the program.
+    HeapStats stats = paced.GcStats();
+    REQUIRE(stats.minor_collections + stats.full_collections == 2);
+
+    Interpreter bounded;
+    bounded.SetReaderThreads(4);
+    bounded.SetObjectLimit(50'000);
+    REQUIRE_THROWS_AS(bounded.RunProgram(source), OutOfMemoryError);
+    REQUIRE(bounded.RunProgram("(define xs '(1 2 3)) (car xs)") == "1");
+    REQUIRE(bounded.GcStats().Live().objects < 50'000);
+}
+
+TEST_CASE("A cancelled marking leaves no marks behind") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    heap.SetIncrementalMarking(std::chrono::microseconds(1));
+    for (int i = 0; !heap.IsMarking(); ++i) {
+        std::string name = "xs" + std::to_string(i % 8);
+        Evaluate(heap, env, "(define " + name + " " + LongList(50'000, false) + ")");
+        heap.CollectYoung(env);
+    }
+    // Allocated while marking, so marked.
+    Cell* box = heap.Make<Cell>(nullptr, nullptr);
+    env.Set("box", box);
+    heap.CancelMarking();
+    REQUIRE(!heap.IsMarking());
+
+    // The next marking must trace box to find what it points to now.
+    box->SetFirst(heap.Make<Cell>(MakeFixnum(-1), nullptr));
+    do {
+        heap.CollectYoung(env);
+    } while (heap.IsMarking());
+    for (int i = 0; i < 10; ++i) {
+        Evaluate(heap, env, LongList(10'000, false));
+    }
+    REQUIRE(As<Number>(As<Cell>(box->GetFirst())->GetFirst())->GetValue() == -1);
+    REQUIRE(!As<Cell>(box->GetFirst())->GetSecond());
+}
+
+TEST_CASE("A collection that overtakes marking counts once") {
+    Heap heap;
+    Enviromnent env = MakeGlobalEnv(&heap);
+    heap.SetIncrementalMarking(std::chrono::microseconds(1));
+    for (int i = 0; !heap.IsMarking(); ++i) {
+        std::string name = "xs" + std::to_string(i % 8);
+        Evaluate(heap, env, "(define " + name + " " + LongList(50'000, false) + ")");
+        heap.CollectYoung(env);
+    }
+    uint64_t full = heap.Stats().full_collections;
+    heap.Collect(env);
+    REQUIRE(!heap.IsMarking());
+    REQUIRE(heap.Stats().full_collections == full + 1);
+}
+
+TEST_CASE("A heap over its limit throws and recovers") {
+    Interpreter interpreter;
+    interpreter.SetObjectLimit(5'000);
+    interpreter.Run("(define (grow n acc) (if (= n 0) acc (grow (- n 1) (cons n acc))))");
+    interpreter.Run("(define kept (grow 500 '()))");
+    // Garbage alone does not trip the limit, however much of it there is.
+    for (int i = 0; i < 20; ++i) {
+        REQUIRE(interpreter.Run("(car (grow 2000 '()))") == "1");
+    }
+
+    // Caught at a safepoint, after a collection frees nothing.
+    REQUIRE_THROWS_AS(interpreter.Run("(grow 10000 '())"), OutOfMemoryError);
+    REQUIRE(interpreter.Run("(car (grow 2000 '()))") == "1");
+    // Caught by Make, which the reader calls without safepoints.
+    REQUIRE_THROWS_AS(interpreter.Run(LongList(10'000, false)), OutOfMemoryError);
+    REQUIRE(interpreter.Run("(car (grow 2000 '()))") == "1");
+    REQUIRE(interpreter.Run("(list-ref kept 499)") == "500");
+    REQUIRE(interpreter.GcStats().Live().objects < 5'000);
+    // Execute leaves the garbage to the next safepoint.
+    auto grow = interpreter.Prepare("(grow n '())");
+    REQUIRE_THROWS_AS(interpreter.Execute(grow, {{"n", interpreter.MakeNumber(10'000)}}),
+                      OutOfMemoryError);
+    Object* small = interpreter.Execute(grow, {{"n", interpreter.MakeNumber(2'000)}});
+    REQUIRE(As<Number>(As<Cell>(small)->GetFirst())->GetValue() == 1);
+    REQUIRE(interpreter.Run("(list-ref kept 499)") == "500");
+
+    Interpreter bounded;
+    bounded.SetMemoryLimit(size_t{1} << 20);
+    bounded.Run("(define (grow n acc) (if (= n 0) acc (grow (- n 1) (cons n acc))))");
+    bounded.Run("(define (grow-all k) (if (= k 0) '() (cons (grow 1000 '()) (grow-all (- k 1)))))");
+    bounded.Run("(define xs (grow-all 5))");
+    REQUIRE_THROWS_AS(bounded.Run("(define ys (grow-all 50))"), OutOfMemoryError);
+    REQUIRE(bounded.Run("(car (car xs))") == "1");
+    for (int i = 0; i < 5; ++i) {
+        REQUIRE(bounded.Run("(car (car (grow-all 20)))") == "1");
+    }
+    REQUIRE(bounded.GcStats().Live().bytes < (size_t{1} << 20));
+}
@@ -0,0 +1,193 @@
+#include "scheme_test.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <system_error>
+
+namespace {
+
+// A path under the temporary directory that no other test, nor another run of the tests, uses.
+// The image there and the temporary file a save writes next to it go with it.
+class ImagePath {
+public:
+    ImagePath()
+        : path_((std::filesystem::temp_directory_path() /
+                 ("scheme_image_" + std::to_string(std::random_device{}()) + "_" +
+                  std::to_string(count_++) + ".img"))
+                    .string()) {
+    }
+    ImagePath(const ImagePath&) = delete;
+    ImagePath& operator=(const ImagePath&) = delete;
+    ~ImagePath() {
+        std::error_code error;
+        std::filesystem::remove_all(path_ + ".tmp", error);
+        std::filesystem::remove(path_, error);
+    }
+
+    operator const std::string&() const {
+        return path_;
+    }
+
+private:
+    static inline int count_ = 0;
+    std::string path_;
+};
+
+}  // namespace
+
+TEST_CASE_METHOD(SchemeTest, "ImageRestoresDefinitions") {
+    ImagePath image_path;
+    const std::string& path = image_path;
+    ExpectNoError("(define (sq x) (* x x))");
+    ExpectNoError("(define big (* 1000000000 1000000000 5))");
+    ExpectNoError("(define small -42)");
+    ExpectNoError("(define flags '(#t #f ()))");
+    ExpectNoError("(define data '(a (b . c) (d) 3))");
+    ExpectNoError("(define plus +)");
+    ExpectNoError("(define + -)");
+    ExpectNoError("(define make-counter (lambda () (define n 0) (lambda () (set! n (plus n 1)) n)))");
+    ExpectNoError("(define counter (make-counter))");
+    ExpectEq("(counter)", "1");
+    ExpectNoError("(define (adder k) (lambda (x) (plus x k)))");
+    ExpectNoError("(define add5 (adder 5))");
+    ExpectNoError("(define ring '(1 2 3))");
+    ExpectNoError("(set-cdr! (cdr (cdr ring)) ring)");
+    interpreter_.SaveImage(path);
+
+    Interpreter restored(path);
+    std::remove(path.c_str());
+    REQUIRE(restored.Run("(sq 12)") == "144");
+    REQUIRE(restored.Run("big") == "5000000000000000000");
+    REQUIRE(restored.Run("small") == "-42");
+    REQUIRE(restored.Run("flags") == "(#t #f ())");
+    REQUIRE(restored.Run("data") == "(a (b . c) (d) 3)");
+    REQUIRE(restored.Run("(+ 5 3)") == "2");
+    REQUIRE(restored.Run("(plus 5 3)") == "8");
+    REQUIRE(restored.Run("(add5 10)") == "15");
+    REQUIRE(restored.Run("(list-ref ring 7)") == "2");
+
+    // The closure kept its state, which the two interpreters now hold separately.
+    REQUIRE(restored.Run("(counter)") == "2");
+    REQUIRE(restored.Run("(counter)") == "3");
+    ExpectEq("(counter)", "2");
+    REQUIRE(restored.Run("((make-counter))") == "1");
+
+    // Restored objects are collected like any others.
+    restored.RunProgram(
+        "(define (churn n) (define junk (list n n n)) (if (= n 0) 0 (churn (plus n -1))))"
+        "(churn 5000)");
+    restored.Run("(define data 0)");
+    restored.RunProgram("(churn 5000)");
+    REQUIRE(restored.Run("(add5 1)") == "6");
+    REQUIRE(restored.Run("(list-ref ring 4)") == "2");
+}
+
+TEST_CASE("ImageOfAFreshInterpreter") {
+    ImagePath image_path;
+    const std::string& path = image_path;
+    Interpreter().SaveImage(path);
+    Interpreter restored(path);
+    std::remove(path.c_str());
+    REQUIRE(restored.Run("(if (< 1 2) (list 1 2) 3)") == "(1 2)");
+    restored.Run("(define (f x) (cons x x))");
+    REQUIRE(restored.Run("(f 1)") == "(1 . 1)");
+}
+
+TEST_CASE("AFailedSaveKeepsThePreviousImage") {
+    ImagePath image_path;
+    const std::string& path = image_path;
+    Interpreter interpreter;
+    interpreter.Run("(define x 1)");
+    interpreter.SaveImage(path);
+
+    // A directory where the image is first written makes the next save fail.
+    std::filesystem::create_directory(path + ".tmp");
+    interpreter.Run("(define x 2)");
+    REQUIRE_THROWS_AS(interpreter.SaveImage(path), std::runtime_error);
+    REQUIRE(Interpreter(path).Run("x") == "1");
+
+    std::filesystem::remove(path + ".tmp");
+    interpreter.SaveImage(path);
+    REQUIRE(Interpreter(path).Run("x") == "2");
+    REQUIRE(!std::filesystem::exists(path + ".tmp"));
+}
+
+TEST_CASE("ImagesGainNewBuiltins") {
+    // An image from a build without any builtins: nothing but an empty global scope.
+    ImagePath image_path;
+    const std::string& path = image_path;
+    {
+        std::ofstream out{path, std::ios::binary};
+        const char empty[] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E', 1, 0, 1, 8, 0, 0};
+        out.write(empty, sizeof(empty));
+    }
+    Interpreter restored(path);
+    std::remove(path.c_str());
+    REQUIRE(restored.Run("(if (list? '(1)) (cons 1 2) 3)") == "(1 . 2)");
+}
+
+TEST_CASE("BrokenImagesAreRejected") {
+    ImagePath image_path;
+    const std::string& path = image_path;
+    REQUIRE_THROWS_AS(Interpreter(path), std::system_error);
+    {
+        std::ofstream out{path};
+        out << "(define x 1)";
+    }
+    REQUIRE_THROWS_AS(Interpreter(path), ImageError);
+
+    Interpreter interpreter;
+    interpreter.Run("(define (f x) (list x 'y))");
+    interpreter.SaveImage(path);
+    std::string image;
+    {
+        std::ifstream in{path, std::ios::binary};
+        image.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    for (size_t size : {image.size() / 3, image.size() / 2, image.size() - 1}) {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        out.write(image.data(), size);
+        out.close();
+        REQUIRE_THROWS_AS(Interpreter(path), ImageError);
+    }
+
+    // Version 1 with the global scope and two scopes that are each other's parent.
+    {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        const char cycle[] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E', 1, 0, 3,
+                              8,   0,   0,   8,   12,  0,   8,   8,   0};
+        out.write(cycle, sizeof(cycle));
+    }
+    REQUIRE_THROWS_AS(Interpreter(path), ImageError);
+}
+
+TEST_CASE("StartupFromSourceAndFromImage", "[.][bench]") {
+    // A prelude of a few thousand definitions, much like a standard library.
+    std::string prelude;
+    for (int i = 0; i < 5000; ++i) {
+        std::string n = std::to_string(i);
+        prelude += "(define (f" + n + " x) (if (< x " + n + ") (list x '(a b " + n +
+                   ")) (+ x (f" + std::to_string(i / 2) + " (- x 1)))))\n";
+        prelude += "(define v" + n + " (list " + n + " (cons 'k " + n + ") (lambda (y) y)))\n";
+    }
+    ImagePath image_path;
+    const std::string& path = image_path;
+
+    auto start = std::chrono::steady_clock::now();
+    Interpreter built;
+    built.RunProgram(prelude);
+    std::chrono::duration<double> from_source = std::chrono::steady_clock::now() - start;
+    built.SaveImage(path);
+
+    start = std::chrono::steady_clock::now();
+    Interpreter restored(path);
+    std::chrono::duration<double> from_image = std::chrono::steady_clock::now() - start;
+    std::ifstream in{path, std::ios::binary | std::ios::ate};
+    std::cerr << "Startup from source: " << from_source.count() * 1e3 << " ms, from a "
+              << in.tellg() / 1024 << " KiB image: " << from_image.count() * 1e3 << " ms\n";
+    REQUIRE(restored.Run("(f4999 3)") == built.Run("(f4999 3)"));
+}
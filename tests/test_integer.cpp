@@ -112,3 +112,12 @@ TEST_CASE_METHOD(SchemeTest, "IntegerAbsEdgeCases") {
     ExpectRuntimeError("(abs #t)");
     ExpectRuntimeError("(abs 1 2)");
 }
+
+TEST_CASE_METHOD(SchemeTest, "IntegersBeyondFixnumRange") {
+    ExpectNoError("(define big (* 2147483647 2147483647 2))");
+    ExpectEq("big", "9223372028264841218");
+    ExpectEq("(number? big)", "#t");
+    ExpectEq("(= big (* 2 2147483647 2147483647))", "#t");
+    ExpectEq("(- big big)", "0");
+    ExpectEq("(- 0 (/ big 2))", "-4611686014132420609");
+}
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <string>
 #include <iostream>
 
@@ -22,6 +23,22 @@ TEST_CASE_METHOD(SchemeTest, "SlowSum") {
     });
 }
 
+TEST_CASE_METHOD(SchemeTest, "SlowSumAllocatesNothingPerIteration") {
+    ExpectNoError("(define slow-add (lambda (x y) (if (= x 0) y (slow-add (- x 1) (+ y 1)))))");
+
+    // Numbers, booleans and the frames of calls that create no closures are not heap-allocated,
+    // so only reading the expression allocates, however deep the recursion goes.
+    auto allocations = [this](const std::string& expression) {
+        alloc_checker::ResetCounters();
+        interpreter_.Run(expression);
+        return alloc_checker::AllocCount();
+    };
+    const std::string shallow = "(slow-add 3 3)";
+    const std::string deep = "(slow-add 1000 1000)";
+    allocations(deep);
+    REQUIRE(allocations(shallow) == allocations(deep));
+}
+
 TEST_CASE_METHOD(SchemeTest, "LambdaClosure") {
     ExpectNoError("(define x 1)");
 
@@ -166,3 +183,13 @@ TEST_CASE_METHOD(SchemeTest, "Redefinition and scoping") {
     ExpectEq("((foobar) 1 2)", "3");
     ExpectEq("(+ 1 2 -3)", "0");
 }
+
+TEST_CASE_METHOD(SchemeTest, "FibThroughput", "[.][bench]") {
+    ExpectNoError("(define (fib x) (if (< x 3) 1 (+ (fib (- x 1)) (fib (- x 2)))))");
+
+    auto start = std::chrono::steady_clock::now();
+    ExpectEq("(fib 25)", "75025");
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cerr << "(fib 25): " << elapsed.count() << "s\n";
+}
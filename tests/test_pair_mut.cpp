@@ -47,3 +47,15 @@ TEST_CASE_METHOD(SchemeTest, "SelfReferenceCdr") {
     ExpectNoError("(set-cdr! (cdr (cdr y)) 3)");
     ExpectEq("(cdr y)", "3");
 }
+
+TEST_CASE_METHOD(SchemeTest, "MutatedPairsSurviveCollection") {
+    // A cons cell is a header and two pointers, with nothing allocated on the side.
+    STATIC_REQUIRE(sizeof(Cell) <= 4 * sizeof(void*));
+
+    ExpectNoError("(define x (list 1 2 3))");
+    for (int i = 0; i < 100; ++i) {
+        ExpectNoError("(set-car! x (list " + std::to_string(i) + " (cons 7 8)))");
+        ExpectNoError("(set-cdr! (cdr x) (list (car x)))");
+    }
+    ExpectEq("x", "((99 (7 . 8)) 2 (99 (7 . 8)))");
+}
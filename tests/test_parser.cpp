@@ -1,16 +1,43 @@
 #include <catch.hpp>
 
+#include <chrono>
+#include <iostream>
 #include <sstream>
 
 #include <error.h>
 #include <parser.h>
 
+bool SameDatum(Object* a, Object* b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    if (Is<Number>(a)) {
+        return Is<Number>(b) && As<Number>(a)->GetValue() == As<Number>(b)->GetValue();
+    }
+    if (Is<Boolean>(a)) {
+        return Is<Boolean>(b) && As<Boolean>(a)->GetValue() == As<Boolean>(b)->GetValue();
+    }
+    if (Is<Symbol>(a)) {
+        return Is<Symbol>(b) && As<Symbol>(a)->GetName() == As<Symbol>(b)->GetName();
+    }
+    return Is<Cell>(a) && Is<Cell>(b) &&
+           SameDatum(As<Cell>(a)->GetFirst(), As<Cell>(b)->GetFirst()) &&
+           SameDatum(As<Cell>(a)->GetSecond(), As<Cell>(b)->GetSecond());
+}
+
 auto ReadFull(const std::string& str) {
     std::stringstream ss{str};
     Tokenizer tokenizer{&ss};
 
     auto obj = Read(&tokenizer);
     REQUIRE(tokenizer.IsEnd());
+
+    // The batch parser must agree with the streaming one.
+    static Heap heap;
+    TokenStream tokens = Tokenize(str);
+    size_t pos = 0;
+    REQUIRE(SameDatum(obj, ReadTokens(tokens, &pos, heap)));
+    REQUIRE(pos == tokens.Size());
     return obj;
 }
 
@@ -51,6 +78,28 @@ TEST_CASE("Read symbol") {
     }
 }
 
+TEST_CASE("Symbols are interned") {
+    Heap heap;
+    size_t initial = heap.Symbols()->Size();
+    Symbol* foo = heap.Intern("foo");
+    REQUIRE(heap.Intern(std::string("foo")) == foo);
+    REQUIRE(heap.Intern("bar") != foo);
+    REQUIRE(foo->GetId() == initial);
+    REQUIRE(heap.Intern("bar")->GetId() == initial + 1);
+
+    Tokenizer tokenizer{std::string_view{"(foo 'bar foo)"}};
+    Object* list = Read(&tokenizer, heap);
+    Object* quoted = As<Cell>(As<Cell>(list)->GetSecond())->GetFirst();
+    REQUIRE(As<Cell>(list)->GetFirst() == foo);
+    REQUIRE(As<Cell>(As<Cell>(quoted)->GetSecond())->GetFirst() == heap.Intern("bar"));
+    REQUIRE(As<Cell>(quoted)->GetFirst() == heap.Intern("quote"));
+    REQUIRE(heap.Symbols()->Size() == initial + 3);
+
+    // Heaps reading in parallel share the symbols of the heap they are spliced into.
+    Heap worker{heap.Symbols()};
+    REQUIRE(worker.Intern("foo") == foo);
+}
+
 TEST_CASE("Lists") {
     SECTION("Empty list") {
         auto null = ReadFull("()");
@@ -143,6 +192,138 @@ TEST_CASE("Lists") {
     }
 }
 
+TEST_CASE("Token stream") {
+    std::string input = "(define (f x) #t)  'sym -12";
+    TokenStream tokens = Tokenize(input);
+
+    std::vector<TokenKind> kinds = {TokenKind::OPEN,   TokenKind::SYMBOL, TokenKind::OPEN,
+                                    TokenKind::SYMBOL, TokenKind::SYMBOL, TokenKind::CLOSE,
+                                    TokenKind::BOOLEAN, TokenKind::CLOSE, TokenKind::QUOTE,
+                                    TokenKind::SYMBOL, TokenKind::CONSTANT};
+    REQUIRE(tokens.kind == kinds);
+    REQUIRE(tokens.Name(1) == "define");
+    REQUIRE(tokens.offset[1] == 1);
+    REQUIRE(tokens.payload[6] == 1);
+    REQUIRE(tokens.Name(9) == "sym");
+    REQUIRE(tokens.payload[10] == -12);
+    REQUIRE(tokens.offset[10] == 24);
+
+    Heap heap;
+    auto objects = ReadAllTokens(tokens, heap);
+    REQUIRE(objects.size() == 3);
+    REQUIRE(Is<Cell>(objects[0]));
+    REQUIRE(Is<Cell>(objects[1]));
+    REQUIRE(As<Number>(objects[2])->GetValue() == -12);
+}
+
+TEST_CASE("Token stream agrees with the streaming lexer") {
+    std::string input = " (+ - -7 +8 +x 12 #t #f #tag #fx) 'a.b\n\t<=? x1! ";
+    TokenStream tokens = Tokenize(input);
+    Tokenizer tokenizer{std::string_view{input}};
+    size_t i = 0;
+    for (; !tokenizer.IsEnd(); tokenizer.Next(), ++i) {
+        REQUIRE(i < tokens.Size());
+        REQUIRE(tokens.offset[i] == tokenizer.GetOffset());
+        const Token& token = tokenizer.GetToken();
+        if (auto* constant = std::get_if<ConstantToken>(&token)) {
+            REQUIRE(tokens.kind[i] == TokenKind::CONSTANT);
+            REQUIRE(tokens.payload[i] == constant->value);
+        } else if (auto* symbol = std::get_if<SymbolToken>(&token)) {
+            REQUIRE(tokens.kind[i] == TokenKind::SYMBOL);
+            REQUIRE(tokens.Name(i) == symbol->name);
+        } else if (auto* boolean = std::get_if<BooleanToken>(&token)) {
+            REQUIRE(tokens.kind[i] == TokenKind::BOOLEAN);
+            REQUIRE(tokens.payload[i] == boolean->f);
+        }
+    }
+    REQUIRE(i == tokens.Size());
+
+    REQUIRE_THROWS_AS(Tokenize("(a #x)"), SyntaxError);
+    REQUIRE_THROWS_AS(Tokenize("(a @)"), SyntaxError);
+}
+
+TEST_CASE("Long and deep lists") {
+    constexpr size_t kSize = 1'000'000;
+    Heap heap;
+
+    SECTION("Long list") {
+        std::string input = "'(";
+        for (size_t i = 0; i < kSize; ++i) {
+            input += std::to_string(i % 10) + " ";
+        }
+        input += ". end)";
+        Tokenizer tokenizer{std::string_view{input}};
+        Object* quoted = ReadWrap(&tokenizer, heap);
+        REQUIRE(tokenizer.IsEnd());
+
+        Object* cur = As<Cell>(As<Cell>(quoted)->GetSecond())->GetFirst();
+        size_t matching = 0;
+        for (size_t i = 0; i < kSize; ++i) {
+            matching += As<Number>(As<Cell>(cur)->GetFirst())->GetValue() == int64_t(i % 10);
+            cur = As<Cell>(cur)->GetSecond();
+        }
+        REQUIRE(matching == kSize);
+        REQUIRE(As<Symbol>(cur)->GetName() == "end");
+    }
+
+    SECTION("Deep list") {
+        std::string input = std::string(kSize, '(') + std::string(kSize, ')');
+        TokenStream tokens = Tokenize(input);
+        size_t pos = 0;
+        Object* cur = ReadTokens(tokens, &pos, heap);
+        REQUIRE(pos == tokens.Size());
+
+        size_t depth = 0;
+        for (; cur && !As<Cell>(cur)->GetSecond(); ++depth) {
+            cur = As<Cell>(cur)->GetFirst();
+        }
+        REQUIRE(!cur);
+        REQUIRE(depth == kSize - 1);
+    }
+}
+
+std::string GenerateRules(size_t count) {
+    std::string source;
+    for (size_t i = 0; i < count; ++i) {
+        std::string id = std::to_string(i);
+        source += "(define (rule-" + id + " x)\n  (if (< x " + id + ") '(low . " + id + ") #f))\n";
+    }
+    return source;
+}
+
+TEST_CASE("Parallel reading") {
+    Heap heap;
+    std::string source = GenerateRules(20'000) + " 42 'tail";
+
+    auto expected = ReadAllTokens(Tokenize(source), heap);
+    for (size_t threads : {1, 2, 3, 8}) {
+        auto objects = ReadParallel(source, heap, threads);
+        REQUIRE(objects.size() == expected.size());
+        size_t same = 0;
+        for (size_t i = 0; i < objects.size(); ++i) {
+            same += SameDatum(objects[i], expected[i]);
+        }
+        REQUIRE(same == expected.size());
+    }
+
+    REQUIRE(ReadParallel("", heap, 4).empty());
+    std::string invalid = GenerateRules(20'000) + "(1 . 2 3)" + GenerateRules(100);
+    REQUIRE_THROWS_AS(ReadParallel(invalid, heap, 4), SyntaxError);
+    REQUIRE_THROWS_AS(ReadParallel(GenerateRules(20'000) + "(unclosed", heap, 4), SyntaxError);
+}
+
+TEST_CASE("Parallel reading throughput", "[.][bench]") {
+    std::string source = GenerateRules(500'000);
+    for (size_t threads : {1, 2, 4, 8}) {
+        Heap heap;
+        auto start = std::chrono::steady_clock::now();
+        auto objects = ReadParallel(source, heap, threads);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << threads << " threads: " << objects.size() << " forms in " << elapsed.count()
+                  << "s\n";
+    }
+}
+
 TEST_CASE("Invalid") {
     REQUIRE_THROWS_AS(ReadFull(""), SyntaxError);
     REQUIRE_THROWS_AS(ReadFull("'"), SyntaxError);
@@ -153,4 +334,128 @@ TEST_CASE("Invalid") {
     REQUIRE_THROWS_AS(ReadFull("(1 . ()"), SyntaxError);
     REQUIRE_THROWS_AS(ReadFull("(1 . )"), SyntaxError);
     REQUIRE_THROWS_AS(ReadFull("(1 . 2 3)"), SyntaxError);
+
+    Heap heap;
+    for (const char* input : {"'", "(", "(1", "(1 .", "( .", "(1 . ()", "(1 . )", "(1 . 2 3)"}) {
+        TokenStream tokens = Tokenize(input);
+        REQUIRE_THROWS_AS(ReadAllTokens(tokens, heap), SyntaxError);
+    }
+}
+
+TEST_CASE("Bulk reading throughput", "[.][bench]") {
+    std::string input;
+    while (input.size() < (8 << 20)) {
+        input += "(define (fib-iter a b count)\n";
+        input += "    (if (= count 0) b (fib-iter (+ a b) a (- count 1))))\n";
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    Heap heap;
+    auto start = Clock::now();
+    TokenStream tokens = Tokenize(input);
+    double lex_time = seconds(start);
+    start = Clock::now();
+    auto objects = ReadAllTokens(tokens, heap);
+    double parse_time = seconds(start);
+
+    Heap streaming_heap;
+    start = Clock::now();
+    size_t streaming_count = 0;
+    for (Tokenizer tokenizer{std::string_view{input}}; !tokenizer.IsEnd(); ++streaming_count) {
+        ReadWrap(&tokenizer, streaming_heap);
+    }
+    double streaming_time = seconds(start);
+
+    REQUIRE(objects.size() == streaming_count);
+    std::cerr << "batch: lex " << lex_time << "s, parse " << parse_time << "s for " << tokens.Size()
+              << " tokens\n";
+    std::cerr << "streaming: " << streaming_time << "s\n";
+}
+
+std::string SerializeAll(const std::vector<Object*>& objects) {
+    std::string res;
+    for (Object* obj : objects) {
+        if (!res.empty()) {
+            res += ' ';
+        }
+        if (!obj) {
+            res += "()";
+        } else if (Is<Number>(obj)) {
+            res += std::to_string(As<Number>(obj)->GetValue());
+        } else if (Is<Symbol>(obj)) {
+            res += As<Symbol>(obj)->GetName();
+        } else if (Is<Cell>(obj)) {
+            res += "<cell>";
+        } else {
+            res += "?";
+        }
+    }
+    return res;
+}
+
+TEST_CASE("Incremental reader") {
+    Heap heap;
+    IncrementalReader reader{heap};
+
+    SECTION("Whole datums") {
+        REQUIRE(SerializeAll(reader.Feed("1 foo (+ 1 2) ")) == "1 foo <cell>");
+        REQUIRE(!reader.HasPending());
+    }
+
+    SECTION("Datum split across chunks") {
+        REQUIRE(reader.Feed("(define (f x)").empty());
+        REQUIRE(reader.Feed(" (+ x 1").empty());
+        REQUIRE(reader.HasPending());
+        REQUIRE(SerializeAll(reader.Feed("))'(1")) == "<cell>");
+        REQUIRE(SerializeAll(reader.Feed(")")) == "<cell>");
+        REQUIRE(!reader.HasPending());
+    }
+
+    SECTION("Token split across chunks") {
+        REQUIRE(reader.Feed("12").empty());
+        REQUIRE(reader.Feed("34").empty());
+        REQUIRE(SerializeAll(reader.Feed(" ab")) == "1234");
+        REQUIRE(SerializeAll(reader.Feed("c(")) == "abc");
+        REQUIRE(SerializeAll(reader.Feed(")")) == "()");
+        REQUIRE(SerializeAll(reader.Finish()) == "");
+    }
+
+    SECTION("Byte at a time") {
+        std::string input = "(1 2 . 3) sym 'x -5 (((a)) b)";
+        std::vector<Object*> all;
+        for (char ch : input) {
+            for (Object* obj : reader.Feed(std::string_view{&ch, 1})) {
+                all.push_back(obj);
+            }
+        }
+        for (Object* obj : reader.Finish()) {
+            all.push_back(obj);
+        }
+        REQUIRE(SerializeAll(all) == "<cell> sym <cell> -5 <cell>");
+    }
+
+    SECTION("Finish flushes a trailing atom") {
+        REQUIRE(reader.Feed("42").empty());
+        REQUIRE(SerializeAll(reader.Finish()) == "42");
+    }
+
+    SECTION("Unfinished input") {
+        REQUIRE(reader.Feed("(1 (2").empty());
+        REQUIRE_THROWS_AS(reader.Finish(), SyntaxError);
+        REQUIRE(SerializeAll(reader.Feed("3 ")) == "3");
+
+        REQUIRE(reader.Feed("'").empty());
+        REQUIRE_THROWS_AS(reader.Finish(), SyntaxError);
+    }
+
+    SECTION("Syntax errors keep earlier datums") {
+        REQUIRE_THROWS_AS(reader.Feed("1 (1 . 2 3) 2 "), SyntaxError);
+        REQUIRE(SerializeAll(reader.Feed("")) == "1 2");
+        REQUIRE_THROWS_AS(reader.Feed(") 5 "), SyntaxError);
+        REQUIRE(SerializeAll(reader.Feed("")) == "5");
+    }
 }
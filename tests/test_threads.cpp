@@ -0,0 +1,63 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <parser.h>
+#include <scheme.h>
+
+TEST_CASE("Interpreters run concurrently") {
+    constexpr int kThreads = 8;
+    constexpr int kIterations = 200;
+
+    std::atomic<int> mismatches{0};
+    std::atomic<int> errors{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.emplace_back([t, &mismatches, &errors] {
+            try {
+                Interpreter interpreter;
+                interpreter.Run("(define (fib x) (if (< x 3) 1 (+ (fib (- x 1)) (fib (- x 2)))))");
+                interpreter.Run("(define id " + std::to_string(t) + ")");
+                for (int i = 0; i < kIterations; ++i) {
+                    // Every Run reads, evaluates and collects in this interpreter's own heap.
+                    mismatches += interpreter.Run("(fib 10)") != "55";
+                    mismatches += interpreter.Run("'(a (b . c) " + std::to_string(i) + ")") !=
+                                  "(a (b . c) " + std::to_string(i) + ")";
+                    mismatches += interpreter.Run("id") != std::to_string(t);
+                }
+            } catch (...) {
+                ++errors;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    REQUIRE(errors == 0);
+    REQUIRE(mismatches == 0);
+}
+
+TEST_CASE("Readers run concurrently") {
+    constexpr int kThreads = 8;
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.emplace_back([&mismatches] {
+            for (int i = 0; i < 1000; ++i) {
+                Tokenizer tokenizer{std::string_view{"(x . 42)"}};
+                Object* pair = Read(&tokenizer);
+                mismatches += As<Number>(As<Cell>(pair)->GetSecond())->GetValue() != 42;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    REQUIRE(mismatches == 0);
+}
@@ -2,7 +2,13 @@
 
 #include <error.h>
 #include <tokenizer.h>
+#include <allocations_checker.h>
 
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
 #include <sstream>
 
 TEST_CASE("Tokenizer works on simple case") {
@@ -153,3 +159,133 @@ TEST_CASE("Empty string handled correctly") {
 
     REQUIRE(tokenizer.IsEnd());
 }
+
+TEST_CASE("Buffer tokenizer matches stream tokenizer") {
+    std::string input = "(define (f x) (if (< x -3) #t #foo)) '(1 . +2) - zog-zog? Am1good?";
+    std::stringstream ss{input};
+    Tokenizer from_stream{&ss};
+    Tokenizer from_buffer{std::string_view{input}};
+
+    while (!from_stream.IsEnd()) {
+        REQUIRE(!from_buffer.IsEnd());
+        REQUIRE(from_buffer.GetToken() == from_stream.GetToken());
+        from_stream.Next();
+        from_buffer.Next();
+    }
+    REQUIRE(from_buffer.IsEnd());
+}
+
+TEST_CASE("Buffer tokenizer edge cases") {
+    SECTION("Empty buffer") {
+        Tokenizer tokenizer{std::string_view{}};
+        REQUIRE(tokenizer.IsEnd());
+    }
+
+    SECTION("Token at the very end") {
+        std::string input = "  12";
+        Tokenizer tokenizer{std::string_view{input}.substr(0, 3)};
+        REQUIRE(tokenizer.GetToken() == Token{ConstantToken{1}});
+        tokenizer.Next();
+        REQUIRE(tokenizer.IsEnd());
+    }
+
+    SECTION("Invalid character") {
+        REQUIRE_THROWS_AS(Tokenizer{std::string_view{"@"}}, SyntaxError);
+    }
+}
+
+TEST_CASE("Mapped file tokenizer") {
+    std::string path = "scheme_mapped_file_test.scm";
+    {
+        std::ofstream out{path};
+        out << "(+ 1 2)\n";
+    }
+    {
+        MappedFile file{path};
+        Tokenizer tokenizer{file.View()};
+        REQUIRE(tokenizer.GetToken() == Token{BracketToken::OPEN});
+        tokenizer.Next();
+        REQUIRE(tokenizer.GetToken() == Token{SymbolToken{"+"}});
+    }
+    std::remove(path.c_str());
+
+    REQUIRE_THROWS(MappedFile{"no/such/file.scm"});
+}
+
+TEST_CASE("Symbol tokens do not allocate") {
+    std::string input;
+    for (int i = 0; i < 1000; ++i) {
+        input += "(some-rather-long-identifier-" + std::string(1 + i % 40, 'x') + " 42 #t) ";
+    }
+
+    auto count_allocations = [](Tokenizer* tokenizer) {
+        alloc_checker::ResetCounters();
+        size_t symbols = 0;
+        for (; !tokenizer->IsEnd(); tokenizer->Next()) {
+            symbols += std::holds_alternative<SymbolToken>(tokenizer->GetToken());
+        }
+        REQUIRE(symbols == 1000);
+        int64_t alloc_count = alloc_checker::AllocCount();
+        std::cerr << "Allocations for 1000 symbols: " << alloc_count << "\n";
+        return alloc_count;
+    };
+
+    SECTION("Buffer") {
+        Tokenizer tokenizer{std::string_view{input}};
+        REQUIRE(count_allocations(&tokenizer) == 0);
+    }
+
+    SECTION("Stream") {
+        // Only the reusable scratch buffer grows, a handful of times.
+        std::stringstream ss{input};
+        Tokenizer tokenizer{&ss};
+        REQUIRE(count_allocations(&tokenizer) <= 8);
+    }
+}
+
+TEST_CASE("Vectorized character runs match the class table") {
+    std::default_random_engine rng{7};
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (unsigned char cls : {charclass::kSpace, charclass::kDigit, charclass::kMidSymbol}) {
+        for (int i = 0; i < 2000; ++i) {
+            std::string s(byte(rng) % 80, ' ');
+            for (auto& ch : s) {
+                // Mostly members of the class, so that runs cross vector boundaries.
+                do {
+                    ch = static_cast<char>(byte(rng));
+                } while (byte(rng) % 16 && !charclass::Is(static_cast<unsigned char>(ch), cls));
+            }
+            size_t expected = 0;
+            while (expected < s.size() &&
+                   (charclass::kTable[static_cast<unsigned char>(s[expected])] & cls)) {
+                ++expected;
+            }
+            REQUIRE(charclass::SkipRun(s.data(), s.data() + s.size(), cls) == s.data() + expected);
+        }
+    }
+}
+
+TEST_CASE("Tokenizer throughput", "[.][bench]") {
+    std::string input;
+    while (input.size() < (8 << 20)) {
+        input += "(define (fib-iter a b count)\n";
+        input += "    (if (= count 0) b (fib-iter (+ a b) a (- count 1))))\n";
+        input += "                                \n";
+        input += "        (define indented-configuration-value    42)\n";
+    }
+
+    auto measure = [&input](const char* name, auto make_tokenizer) {
+        auto start = std::chrono::steady_clock::now();
+        size_t tokens = 0;
+        for (auto tokenizer = make_tokenizer(); !tokenizer.IsEnd(); tokenizer.Next()) {
+            ++tokens;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << name << ": " << tokens << " tokens, "
+                  << static_cast<double>(input.size()) / elapsed.count() / (1 << 20) << " MiB/s\n";
+    };
+
+    std::stringstream ss{input};
+    measure("istream", [&ss] { return Tokenizer{&ss}; });
+    measure("buffer", [&input] { return Tokenizer{std::string_view{input}}; });
+}
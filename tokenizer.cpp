@@ -1 +1,251 @@
 #include <tokenizer.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCHEME_TOKENIZER_X86 1
+#endif
+
+namespace charclass {
+namespace {
+
+const char* SkipRunScalar(const char* pos, const char* end, unsigned char cls) {
+    while (pos != end && (kTable[static_cast<unsigned char>(*pos)] & cls)) {
+        ++pos;
+    }
+    return pos;
+}
+
+#ifdef SCHEME_TOKENIZER_X86
+
+// The vector variants classify with byte range checks: x is in [lo, lo + n] iff
+// min(x - lo, n) == x - lo in unsigned arithmetic.
+
+__attribute__((target("sse2"))) __m128i InRange(__m128i x, char lo, char n) {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(n)), shifted);
+}
+
+__attribute__((target("sse2"))) __m128i Match(__m128i x, unsigned char cls) {
+    if (cls == kSpace) {
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), InRange(x, '\t', '\r' - '\t'));
+    }
+    __m128i digit = InRange(x, '0', 9);
+    if (cls == kDigit) {
+        return digit;
+    }
+    __m128i alpha = InRange(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+    __m128i punct = _mm_or_si128(
+        InRange(x, '<', '?' - '<'),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('!')),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8('#'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('*')),
+                                  _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                                               _mm_cmpeq_epi8(x, _mm_set1_epi8('/'))))));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), punct);
+}
+
+__attribute__((target("sse2"))) const char* SkipRunSse2(const char* pos, const char* end,
+                                                         unsigned char cls) {
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(Match(chunk, cls))) ^ 0xFFFFu;
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return SkipRunScalar(pos, end, cls);
+}
+
+__attribute__((target("avx2"))) __m256i InRange(__m256i x, char lo, char n) {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(n)), shifted);
+}
+
+__attribute__((target("avx2"))) __m256i Match(__m256i x, unsigned char cls) {
+    if (cls == kSpace) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                               InRange(x, '\t', '\r' - '\t'));
+    }
+    __m256i digit = InRange(x, '0', 9);
+    if (cls == kDigit) {
+        return digit;
+    }
+    __m256i alpha = InRange(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+    __m256i punct = _mm256_or_si256(
+        InRange(x, '<', '?' - '<'),
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('!')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('#'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+                                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/'))))));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), punct);
+}
+
+__attribute__((target("avx2"))) const char* SkipRunAvx2(const char* pos, const char* end,
+                                                         unsigned char cls) {
+    while (end - pos >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(Match(chunk, cls)));
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+    return SkipRunSse2(pos, end, cls);
+}
+
+#endif
+
+using SkipRunFn = const char* (*)(const char*, const char*, unsigned char);
+
+SkipRunFn SelectSkipRun() {
+#ifdef SCHEME_TOKENIZER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &SkipRunAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &SkipRunSse2;
+    }
+#endif
+    return &SkipRunScalar;
+}
+
+}  // namespace
+
+const char* SkipRun(const char* pos, const char* end, unsigned char cls) {
+    // Most runs are a few bytes long, so the first character is checked before paying for a call.
+    if (pos == end || !(kTable[static_cast<unsigned char>(*pos)] & cls)) {
+        return pos;
+    }
+    static const SkipRunFn kSkipRun = SelectSkipRun();
+    return kSkipRun(pos + 1, end, cls);
+}
+
+}  // namespace charclass
+
+TokenStream Tokenize(std::string_view source) {
+    if (source.size() > UINT32_MAX) {
+        throw std::length_error("source too large to tokenize");
+    }
+    TokenStream tokens;
+    tokens.source = source;
+    // Typical Scheme sources have a token every few bytes.
+    size_t expected = source.size() / 4 + 1;
+    tokens.kind.reserve(expected);
+    tokens.payload.reserve(expected);
+    tokens.offset.reserve(expected);
+
+    // The rules are those of Tokenizer::Lex, applied straight to the buffer so that no Token is
+    // built per token.
+    using charclass::kTable;
+    const char* begin = source.data();
+    const char* end = begin + source.size();
+    const char* pos = charclass::SkipRun(begin, end, charclass::kSpace);
+    while (pos != end) {
+        const char* start = pos;
+        unsigned char c = *pos++;
+        TokenKind kind;
+        int64_t payload = 0;
+        switch (c) {
+            case '(':
+                kind = TokenKind::OPEN;
+                break;
+            case ')':
+                kind = TokenKind::CLOSE;
+                break;
+            case '\'':
+                kind = TokenKind::QUOTE;
+                break;
+            case '.':
+                kind = TokenKind::DOT;
+                break;
+            default:
+                if (kTable[c] & charclass::kDigit) {
+                    pos = charclass::SkipRun(pos, end, charclass::kDigit);
+                    kind = TokenKind::CONSTANT;
+                    payload = Tokenizer::ParseDigits({start, static_cast<size_t>(pos - start)});
+                } else if (c == '+' || c == '-') {
+                    const char* digits = pos;
+                    pos = charclass::SkipRun(pos, end, charclass::kDigit);
+                    if (pos != digits) {
+                        int value =
+                            Tokenizer::ParseDigits({digits, static_cast<size_t>(pos - digits)});
+                        kind = TokenKind::CONSTANT;
+                        payload = c == '-' ? -value : value;
+                    } else {
+                        kind = TokenKind::SYMBOL;
+                        payload = 1;
+                    }
+                } else if (c == '#') {
+                    if (pos == end || (*pos != 't' && *pos != 'f')) {
+                        throw SyntaxError("");
+                    }
+                    bool value = *pos++ == 't';
+                    if (pos != end && (kTable[static_cast<unsigned char>(*pos)] &
+                                       charclass::kMidSymbol)) {
+                        pos = charclass::SkipRun(pos, end, charclass::kMidSymbol);
+                        kind = TokenKind::SYMBOL;
+                        payload = pos - start;
+                    } else {
+                        kind = TokenKind::BOOLEAN;
+                        payload = value;
+                    }
+                } else if (kTable[c] & charclass::kStartSymbol) {
+                    pos = charclass::SkipRun(pos, end, charclass::kMidSymbol);
+                    kind = TokenKind::SYMBOL;
+                    payload = pos - start;
+                } else {
+                    throw SyntaxError("");
+                }
+                break;
+        }
+        tokens.kind.push_back(kind);
+        tokens.payload.push_back(payload);
+        tokens.offset.push_back(static_cast<uint32_t>(start - begin));
+        pos = charclass::SkipRun(pos, end, charclass::kSpace);
+    }
+    return tokens;
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        ::madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
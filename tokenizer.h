@@ -1,12 +1,19 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <variant>
 #include <optional>
 #include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "error.h"
 
+// The name is a view into the tokenizer input (or, for istream input, into a scratch buffer owned
+// by the tokenizer) and stays valid until the next call to Tokenizer::Next().
 struct SymbolToken {
-    std::string name;
+    std::string_view name;
 
     bool operator==(const SymbolToken& other) const {
         return name == other.name;
@@ -45,10 +52,115 @@ struct BooleanToken {
 using Token =
     std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, BooleanToken>;
 
+// Character classes used by the lexer. The table is built at compile time over the "C" locale, so
+// classification is a single load instead of a locale-aware library call.
+namespace charclass {
+
+enum : unsigned char {
+    kSpace = 1 << 0,
+    kDigit = 1 << 1,
+    kStartSymbol = 1 << 2,
+    kMidSymbol = 1 << 3,
+};
+
+constexpr std::array<unsigned char, 256> MakeTable() {
+    std::array<unsigned char, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        bool digit = c >= '0' && c <= '9';
+        bool start = alpha || c == '<' || c == '>' || c == '=' || c == '*' || c == '/' || c == '#';
+        bool mid = start || digit || c == '?' || c == '!' || c == '-';
+        bool space = c == ' ' || (c >= '\t' && c <= '\r');
+        table[c] = (space ? kSpace : 0) | (digit ? kDigit : 0) | (start ? kStartSymbol : 0) |
+                   (mid ? kMidSymbol : 0);
+    }
+    return table;
+}
+
+inline constexpr std::array<unsigned char, 256> kTable = MakeTable();
+
+inline bool Is(int c, unsigned char cls) {
+    return c != EOF && (kTable[static_cast<unsigned char>(c)] & cls);
+}
+
+// Returns the first position in [pos, end) whose character is not in class cls, which must be one
+// of kSpace, kDigit or kMidSymbol. Scans 32 or 16 bytes at a time with AVX2 or SSE2 when the CPU
+// supports it, and falls back to the table otherwise.
+const char* SkipRun(const char* pos, const char* end, unsigned char cls);
+
+}  // namespace charclass
+
 class Tokenizer {
 private:
+    // Character sources the lexer is instantiated over. Both expose the same interface, so the
+    // buffer variant compiles down to plain pointer arithmetic without any virtual calls. Text()
+    // returns everything consumed since StartToken().
+    struct StreamSource {
+        std::istream* stream;
+        std::string* scratch;
+
+        int Peek() {
+            return stream->peek();
+        }
+        int Get() {
+            int c = stream->get();
+            if (c != EOF) {
+                scratch->push_back(static_cast<char>(c));
+            }
+            return c;
+        }
+        void SkipRun(unsigned char cls) {
+            while (charclass::Is(stream->peek(), cls)) {
+                stream->get();
+            }
+        }
+        void StartToken() {
+            scratch->clear();
+        }
+        std::string_view TakeRun(unsigned char cls) {
+            while (charclass::Is(stream->peek(), cls)) {
+                scratch->push_back(static_cast<char>(stream->get()));
+            }
+            return *scratch;
+        }
+        std::string_view Text() const {
+            return *scratch;
+        }
+    };
+
+    struct BufferSource {
+        const char* pos;
+        const char* end;
+        const char* start = nullptr;
+
+        int Peek() {
+            return pos != end ? static_cast<unsigned char>(*pos) : EOF;
+        }
+        int Get() {
+            return pos != end ? static_cast<unsigned char>(*pos++) : EOF;
+        }
+        void SkipRun(unsigned char cls) {
+            pos = charclass::SkipRun(pos, end, cls);
+        }
+        void StartToken() {
+            start = pos;
+        }
+        std::string_view TakeRun(unsigned char cls) {
+            pos = charclass::SkipRun(pos, end, cls);
+            return Text();
+        }
+        std::string_view Text() const {
+            return {start, static_cast<size_t>(pos - start)};
+        }
+    };
+
     int symb_ = 0;
-    std::istream* stream_;
+    std::istream* stream_ = nullptr;
+    const char* begin_ = nullptr;
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+    const char* token_start_ = nullptr;
+    std::string scratch_;
     std::optional<Token> current_;
 
 public:
@@ -56,41 +168,54 @@ public:
         Next();
     };
 
+    // Tokenizes a contiguous buffer in place. The buffer must outlive the tokenizer, and symbol
+    // tokens point straight into it.
+    explicit Tokenizer(std::string_view source)
+        : begin_(source.data()), pos_(source.data()), end_(source.data() + source.size()) {
+        Next();
+    };
+
+    // Tokens may refer to scratch_, so a copy would dangle.
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
     bool IsEnd() {
         return !current_.has_value();
     };
     bool IsStartSymbol(int c) {
-        if (c == EOF) {
-            return false;
-        }
-        unsigned char ch = static_cast<unsigned char>(c);
-        return std::isalpha(ch) || ch == '<' || ch == '>' || ch == '=' || ch == '*' || ch == '/' ||
-               ch == '#';
+        return charclass::Is(c, charclass::kStartSymbol);
     }
 
     bool IsMidSymbol(int c) {
-        if (c == EOF) {
-            return false;
-        }
-        unsigned char ch = static_cast<unsigned char>(c);
-        return std::isalpha(ch) || std::isdigit(ch) || ch == '<' || ch == '>' || ch == '=' ||
-               ch == '*' || ch == '/' || ch == '#' || ch == '?' || ch == '!' || ch == '-';
+        return charclass::Is(c, charclass::kMidSymbol);
     }
-    void SkipWhitespace() {
-        while (stream_->peek() != EOF &&
-               std::isspace(static_cast<unsigned char>(stream_->peek()))) {
-            stream_->get();
+
+    void Next() {
+        if (stream_) {
+            StreamSource src{stream_, &scratch_};
+            Lex(src);
+            return;
         }
+        BufferSource src{pos_, end_};
+        Lex(src);
+        pos_ = src.pos;
+        token_start_ = src.start;
     }
 
-    void Next() {
-        SkipWhitespace();
-        if (stream_->peek() == EOF) {
+    // Byte offset of the current token in the source buffer. Only meaningful in buffer mode.
+    size_t GetOffset() const {
+        return token_start_ - begin_;
+    }
+
+    template <class Source>
+    void Lex(Source& src) {
+        src.SkipRun(charclass::kSpace);
+        if (src.Peek() == EOF) {
             current_.reset();
             return;
         }
-        symb_ = stream_->get();
-        std::string token;
+        src.StartToken();
+        symb_ = src.Get();
         switch (symb_) {
             case '(':
                 current_ = Token{BracketToken::OPEN};
@@ -107,30 +232,14 @@ public:
             default:
                 break;
         }
-        if (std::isdigit(static_cast<unsigned char>(symb_))) {
-            int value = symb_ - '0';
-            while (stream_->peek() != EOF &&
-                   std::isdigit(static_cast<unsigned char>(stream_->peek()))) {
-                symb_ = stream_->get();
-
-                value = value * 10 + (symb_ - '0');
-            }
-            current_ = Token{ConstantToken{value}};
+        if (charclass::Is(symb_, charclass::kDigit)) {
+            current_ = Token{ConstantToken{ParseDigits(src.TakeRun(charclass::kDigit))}};
             return;
         }
         if (symb_ == '+' || symb_ == '-') {
-            if (stream_->peek() != EOF &&
-                std::isdigit(static_cast<unsigned char>(stream_->peek()))) {
+            if (charclass::Is(src.Peek(), charclass::kDigit)) {
                 char sign = symb_;
-                int value = 0;
-                symb_ = stream_->get();
-                value = symb_ - '0';
-                while (stream_->peek() != EOF &&
-                       std::isdigit(static_cast<unsigned char>(stream_->peek()))) {
-                    symb_ = stream_->get();
-
-                    value = value * 10 + (symb_ - '0');
-                }
+                int value = ParseDigits(src.TakeRun(charclass::kDigit).substr(1));
                 if (sign == '+') {
                     current_ = Token{ConstantToken{value}};
                     return;
@@ -138,43 +247,79 @@ public:
                 current_ = Token{ConstantToken{-value}};
                 return;
             }
-            current_ = Token{SymbolToken{std::string(1, static_cast<char>(symb_))}};
+            current_ = Token{SymbolToken{src.Text()}};
             return;
         } else if (symb_ == '#') {
-            int c = stream_->peek();
+            int c = src.Peek();
             if ((c == 't' || c == 'f') && c != EOF) {
-                stream_->get();
-                int after = stream_->peek();
+                src.Get();
+                int after = src.Peek();
                 if (!IsMidSymbol(after)) {
                     current_ = Token{BooleanToken{c == 't'}};
                     return;
                 }
-                std::string token;
-                token.push_back('#');
-                token.push_back(static_cast<char>(c));
-                while (IsMidSymbol(stream_->peek())) {
-                    symb_ = stream_->get();
-                    token.push_back(static_cast<char>(symb_));
-                }
-                current_ = Token{SymbolToken{token}};
+                current_ = Token{SymbolToken{src.TakeRun(charclass::kMidSymbol)}};
                 return;
             }
         } else if (IsStartSymbol(symb_)) {
-            token.push_back(static_cast<char>(symb_));
-            while (IsMidSymbol(stream_->peek())) {
-                symb_ = stream_->get();
-
-                token.push_back(static_cast<char>(symb_));
-            }
-            current_ = Token{SymbolToken{token}};
+            current_ = Token{SymbolToken{src.TakeRun(charclass::kMidSymbol)}};
             return;
         }
         throw(SyntaxError(""));
     }
-    Token GetToken() {
+    const Token& GetToken() {
         if (!current_) {
             throw SyntaxError("");
         }
         return *current_;
     }
+
+    // The value of a run of decimal digits; shared with Tokenize.
+    static int ParseDigits(std::string_view digits) {
+        int value = 0;
+        for (char ch : digits) {
+            value = value * 10 + (ch - '0');
+        }
+        return value;
+    }
+};
+
+enum class TokenKind : uint8_t { CONSTANT, OPEN, CLOSE, SYMBOL, QUOTE, DOT, BOOLEAN };
+
+// A whole buffer lexed up front into parallel arrays, so that the lexer runs as one loop with no
+// parser calls in between. The payload is the value of a CONSTANT, 0 or 1 for a BOOLEAN and the
+// length of a SYMBOL, whose text is source.substr(offset[i], payload[i]).
+struct TokenStream {
+    std::string_view source;
+    std::vector<TokenKind> kind;
+    std::vector<int64_t> payload;
+    std::vector<uint32_t> offset;
+
+    size_t Size() const {
+        return kind.size();
+    }
+
+    std::string_view Name(size_t i) const {
+        return source.substr(offset[i], payload[i]);
+    }
+};
+
+// Sources are limited to 4 GiB so that offsets fit in 32 bits.
+TokenStream Tokenize(std::string_view source);
+
+// Read-only memory mapping of a whole file, suitable as a Tokenizer buffer.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view View() const {
+        return {data_, size_};
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
 };